@@ -24,6 +24,11 @@
 #include <strings.h>
 #include <math.h>
 #include "cmdlnopts.h"
+#include "decode.h"
+#include "logfile.h"
+#include "shmtap.h"
+#include "term.h"
+#include "timing.h"
 #include "usefull_macros.h"
 
 /*
@@ -43,7 +48,36 @@ glob_pars const Gdefault = {
     57600,          // common speed for all terminals
     NULL,           // name of common log file (dublicate of stdout)
     NULL,           // the rest parameters: array of char*
-    0               // use character mode instead of lines
+    0,              // use character mode instead of lines
+    IDX_DEFSTEP,    // amount of records between log index entries
+    NULL,           // name of shared memory ring for live readers
+    SHMTAP_DEFSIZE, // its size (MB)
+    NULL,           // socket for live viewers
+    0,              // own ports & forward data between them and pty
+    NULL,           // configuration file with ports' settings
+    NULL,           // list of CPUs for capture thread
+    0,              // SCHED_FIFO priority of capture thread
+    0,              // lock memory
+    NULL,           // flush policy
+    NULL,           // sync policy of logs
+    STDQ_DEFSIZE/1024, // size of stdout queue (KB)
+    0,              // don't write records to stdout
+    NULL,           // flight recorder mode settings
+    NULL,           // byte patterns triggering flight recorder
+    0,              // amount of framing errors triggering flight recorder
+    NULL,           // byte patterns searched in data
+    NULL,           // log of patterns' matches
+    0,              // print matches on stdout
+    0,              // write times of data chunks into timing files
+    NULL,           // protocol decoder of ports
+    NULL,           // encoding of ports' data in stdout & socket outputs
+    NULL,           // format of time in headers
+    0,              // max time of collapsing repeated records (s)
+    NULL,           // rate limit of ports' records
+    NULL,           // rate limit of common log
+    NULL,           // rate limit of stdout
+    0,              // amount of worker processes
+    INIT_DEFTHREADS // amount of threads opening ports at start
 };
 
 /*
@@ -59,6 +93,35 @@ myoption cmdlnopts[] = {
     {"all-log", NEED_ARG,   NULL,   'o',    arg_string, APTR(&G.commonlog), _("filename of common log")},
     {"rewrite", NO_ARGS,    NULL,   'r',    arg_none,   APTR(&rewrite_ifexists),_("rewrite existing log files")},
     {"char-mode",NO_ARGS,   NULL,   'c',    arg_none,   APTR(&G.charmode),  _("use character mode instead of lines")},
+    {"index-step",NEED_ARG, NULL,   'I',    arg_int,    APTR(&G.idxstep),   _("amount of records between log index entries (0 - don't index)")},
+    {"shm",     NEED_ARG,   NULL,   's',    arg_string, APTR(&G.shmname),   _("publish records into shared memory ring with given name (like /multiterm)")},
+    {"shm-size",NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.shmsize),   _("size of shared memory ring, MB")},
+    {"passthrough",NO_ARGS, NULL,   'P',    arg_none,   APTR(&G.passthrough),_("passthrough mode: open ports read-write and forward data to/from new pty")},
+    {"listen",  NEED_ARG,   NULL,   'l',    arg_string, APTR(&G.listenaddr),_("stream records to clients of UNIX socket (path) or TCP ([host]:port)")},
+    {"config",  NEED_ARG,   NULL,   'C',    arg_string, APTR(&G.config),    _("configuration file with ports' settings")},
+    {"affinity",NEED_ARG,   NULL,   'A',    arg_string, APTR(&G.cpus),      _("pin capture thread to given CPUs (like 0,2-3)")},
+    {"rtprio",  NEED_ARG,   NULL,   'R',    arg_int,    APTR(&G.rtprio),    _("run capture thread under SCHED_FIFO with given priority")},
+    {"mlock",   NO_ARGS,    NULL,   'M',    arg_none,   APTR(&G.mlock),     _("lock all memory and prefault buffers")},
+    {"flush",   NEED_ARG,   NULL,   'F',    arg_string, APTR(&G.flush),     _("flush policy: \"exact\" (each record at once) or \"latency=ms,bytes=N\" (batch outputs)")},
+    {"durable", NEED_ARG,   NULL,   'D',    arg_string, APTR(&G.durable),   _("sync logs in background: \"ms=N\", \"mb=N\" or \"range=MB\" (sync_file_range() windows), \"direct\" - use O_DIRECT")},
+    {"stdout-queue",NEED_ARG,NULL,  0,      arg_int,    APTR(&G.stdqueue),  _("size of stdout queue, KB (records are dropped when it's full)")},
+    {"quiet",   NO_ARGS,    NULL,   'q',    arg_none,   APTR(&G.quiet),     _("don't write records to stdout")},
+    {"flight",  NEED_ARG,   NULL,   'f',    arg_string, APTR(&G.flight),    _("flight recorder mode: keep records in RAM and log them only after trigger (\"mb=ring size,s=seconds before,post=seconds after\")")},
+    {"trigger", MULT_PAR,   NULL,   0,      arg_string, APTR(&G.trigger),   _("byte pattern which triggers flight recorder (\\n, \\r, \\t, \\xHH escapes allowed)")},
+    {"trigger-errors",NEED_ARG,NULL,0,      arg_int,    APTR(&G.trigerrors),_("amount of framing/parity errors on port which triggers flight recorder")},
+    {"match",   MULT_PAR,   NULL,   'm',    arg_string, APTR(&G.match),     _("byte pattern to count & log its matches (\\n, \\r, \\t, \\xHH escapes allowed)")},
+    {"match-log",NEED_ARG,  NULL,   0,      arg_string, APTR(&G.matchlog),  _("log file of patterns' matches")},
+    {"match-color",NO_ARGS, NULL,   0,      arg_none,   APTR(&G.matchcolor),_("print patterns' matches on stdout")},
+    {"timing",  NO_ARGS,    NULL,   'T',    arg_none,   APTR(&G.timing),    _("write times of data chunks read into timing files (logname" TIM_SUFFIX ")")},
+    {"decoder", NEED_ARG,   NULL,   'd',    arg_string, APTR(&G.decoder),   _("decode protocol of ports: modbus, nmea, slip or cobs (summaries are written into logname" DEC_SUFFIX ")")},
+    {"encoding",NEED_ARG,   NULL,   'E',    arg_string, APTR(&G.encoding),  _("encoding of data in stdout & socket outputs: raw, hex, escape or base64 (logs are always raw)")},
+    {"time-format",NEED_ARG,NULL,   0,      arg_string, APTR(&G.timefmt),   _("format of time in headers: rel (seconds from start, default), epoch (UNIX time) or iso (ISO-8601 UTC)")},
+    {"dedup",   NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.dedup),     _("collapse repeated records into \"last line repeated N times\" for no more than given time, s")},
+    {"limit",   NEED_ARG,   NULL,   0,      arg_string, APTR(&G.limit),     _("rate limit of ports' records: \"bytes=N,recs=N[,sample=N][,full]\" (per second; sample - pass each N-th record over limit, full - keep port's log complete)")},
+    {"limit-common",NEED_ARG,NULL,  0,      arg_string, APTR(&G.limitcommon),_("rate limit of common log: \"bytes=N,recs=N[,sample=N]\"")},
+    {"limit-stdout",NEED_ARG,NULL,  0,      arg_string, APTR(&G.limitstdout),_("rate limit of stdout: \"bytes=N,recs=N[,sample=N]\"")},
+    {"workers", NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.workers),   _("capture ports by given amount of worker processes (records are merged by supervisor, died workers are restarted)")},
+    {"init-threads",NEED_ARG,NULL,  0,      arg_int,    APTR(&G.initthreads),_("amount of threads opening & setting up ports at start (default: 8)")},
     end_option
 };
 
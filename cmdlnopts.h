@@ -37,6 +37,35 @@ typedef struct{
     char *commonlog;    // name of common log file (dublicate of stdout)
     char** rest_pars;   // the rest parameters: array of char*
     int charmode;       // use character mode instead of lines
+    int idxstep;        // amount of records between log index entries
+    char *shmname;      // name of shared memory ring for live readers
+    int shmsize;        // its size (MB)
+    char *listenaddr;   // socket for live viewers
+    int passthrough;    // own ports & forward data between them and pty
+    char *config;       // configuration file with ports' settings
+    char *cpus;         // list of CPUs for capture thread
+    int rtprio;         // SCHED_FIFO priority of capture thread
+    int mlock;          // lock memory
+    char *flush;        // flush policy
+    char *durable;      // sync policy of logs
+    int stdqueue;       // size of stdout queue (KB)
+    int quiet;          // don't write records to stdout
+    char *flight;       // flight recorder mode settings
+    char **trigger;     // byte patterns triggering flight recorder
+    int trigerrors;     // amount of framing errors triggering flight recorder
+    char **match;       // byte patterns searched in data
+    char *matchlog;     // log of patterns' matches
+    int matchcolor;     // print matches on stdout
+    int timing;         // write times of data chunks into timing files
+    char *decoder;      // protocol decoder of ports
+    char *encoding;     // encoding of ports' data in stdout & socket outputs
+    char *timefmt;      // format of time in headers
+    int dedup;          // max time of collapsing repeated records (s)
+    char *limit;        // rate limit of ports' records
+    char *limitcommon;  // rate limit of common log
+    char *limitstdout;  // rate limit of stdout
+    int workers;        // amount of worker processes (0 - capture in single process)
+    int initthreads;    // amount of threads opening ports at start
 } glob_pars;
 
 
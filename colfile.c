@@ -0,0 +1,554 @@
+/*
+ * colfile.c - columnar chunked export of logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <float.h>          // DBL_MAX
+#include <inttypes.h>       // PRIu64
+#include <pthread.h>
+#include <zlib.h>
+#include "colfile.h"
+#include "timing.h"         // put_varint, get_varint
+
+// growing buffer of one column
+typedef struct{
+    char *buf;
+    size_t len;
+    size_t sz;
+} column;
+
+// columns of chunk being converted
+enum{
+    C_TIMES,
+    C_PORTS,
+    C_LENS,
+    C_DATA,
+    C_ZDATA,
+    C_AMOUNT
+};
+
+// part of log converted into one chunk
+typedef struct{
+    logsrc *src;        // log file
+    size_t start;       // offset of first record
+    size_t end;         // offset after last record
+    double dt;          // shift of times (t0 of log with relative times when output is absolute)
+    colchunk dir;       // directory entry (nrecs == 0 if chunk is empty)
+} job;
+
+static job *jobs = NULL;
+static size_t njobs = 0, jobssz = 0, nextjob = 0;
+// port names of output file
+static char **cports = NULL;
+static uint32_t ncports = 0, cportssz = 0;
+static pthread_mutex_t portmutex = PTHREAD_MUTEX_INITIALIZER;
+// ports selected
+static char **selports = NULL;
+// output file, offset of next chunk & write errors flag
+static int outfd = -1, failed = 0;
+static uint64_t outoff = 0;
+
+static void col_reserve(column *c, size_t add){
+    if(c->len + add <= c->sz) return;
+    c->sz = 2 * (c->len + add);
+    if(c->sz < 65536) c->sz = 65536;
+    c->buf = realloc(c->buf, c->sz);
+    if(!c->buf) ERR("realloc");
+}
+
+static inline void col_varint(column *c, uint64_t v){
+    col_reserve(c, 10);
+    c->len += put_varint(c->buf + c->len, v);
+}
+
+static inline void col_add(column *c, const char *data, size_t len){
+    col_reserve(c, len);
+    memcpy(c->buf + c->len, data, len);
+    c->len += len;
+}
+
+static inline uint64_t zigzag(int64_t v){
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+static inline int64_t unzigzag(uint64_t v){
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline int64_t t2us(double t){
+    return (int64_t)(t * 1e6 + (t < 0. ? -0.5 : 0.5));
+}
+
+static void add_job(logsrc *s, size_t start, size_t end, double dt){
+    if(njobs == jobssz){
+        jobssz += 256;
+        jobs = realloc(jobs, jobssz * sizeof(job));
+        if(!jobs) ERR("realloc");
+    }
+    job *j = &jobs[njobs++];
+    memset(j, 0, sizeof(job));
+    j->src = s;
+    j->start = start;
+    j->end = end;
+    j->dt = dt;
+}
+
+/**
+ * Get id of port name (add it into table if it's new)
+ */
+static uint32_t port_id(const char *name, size_t len){
+    uint32_t i;
+    pthread_mutex_lock(&portmutex);
+    for(i = 0; i < ncports; ++i)
+        if(strlen(cports[i]) == len && !memcmp(cports[i], name, len)) break;
+    if(i == ncports){
+        if(ncports == cportssz){
+            cportssz += 64;
+            cports = realloc(cports, cportssz * sizeof(char*));
+            if(!cports) ERR("realloc");
+        }
+        cports[ncports++] = strndup(name, len);
+    }
+    pthread_mutex_unlock(&portmutex);
+    return i;
+}
+
+// ports already met by worker (to look up global table only once)
+typedef struct{
+    const char *name;
+    size_t len;
+    uint32_t id;
+} portcache;
+
+static void write_all(const char *data, size_t len, uint64_t off){
+    while(len){
+        ssize_t w = pwrite(outfd, data, len, (off_t)off);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            WARN(_("Can't write columnar file"));
+            failed = 1;
+            return;
+        }
+        data += w; len -= w; off += w;
+    }
+}
+
+/**
+ * Convert part of log into chunk & write it at the end of output file
+ * @param j    - job
+ * @param cols - buffers of columns (C_AMOUNT items)
+ */
+static void convert(job *j, column *cols){
+    logsrc *s = j->src;
+    portcache cache[64];
+    int ncache = 0;
+    for(int i = 0; i < C_AMOUNT; ++i) cols[i].len = 0;
+    double tmin = DBL_MAX, tmax = -DBL_MAX;
+    int64_t prev = 0;
+    uint32_t N = 0;
+    size_t off = j->start;
+    logrec r;
+    while(off < j->end && log_getrec(s->map, off, &r)){
+        off = r.next;
+        if(r.t < s->ts) continue;
+        if(r.t > s->te) break;
+        const char *pn = s->port;
+        size_t pl;
+        if(r.port){
+            if(!portmatch(r.port, r.portlen, selports)) continue;
+            pn = r.port;
+            pl = r.portlen;
+        }else pl = strlen(pn);
+        uint32_t id = UINT32_MAX;
+        for(int i = 0; i < ncache; ++i)
+            if(cache[i].len == pl && !memcmp(cache[i].name, pn, pl)){
+                id = cache[i].id;
+                break;
+            }
+        if(id == UINT32_MAX){
+            id = port_id(pn, pl);
+            if(ncache < 64) cache[ncache++] = (portcache){.name = pn, .len = pl, .id = id};
+        }
+        int64_t us = t2us(r.t + j->dt);
+        col_varint(&cols[C_TIMES], zigzag(us - prev));
+        prev = us;
+        col_varint(&cols[C_PORTS], id);
+        col_varint(&cols[C_LENS], r.len);
+        col_add(&cols[C_DATA], r.data, r.len);
+        double t = us / 1e6;
+        if(t < tmin) tmin = t;
+        if(t > tmax) tmax = t;
+        ++N;
+    }
+    if(!N) return;
+    column *z = &cols[C_ZDATA];
+    uLongf zlen = compressBound(cols[C_DATA].len);
+    col_reserve(z, zlen);
+    if(compress2((Bytef*)z->buf, &zlen, (const Bytef*)cols[C_DATA].buf, cols[C_DATA].len, COL_ZLEVEL) != Z_OK){
+        WARNX(_("%s: can't compress chunk"), s->name);
+        failed = 1;
+        return;
+    }
+    z->len = zlen;
+    colchunk *d = &j->dir;
+    d->tmin = tmin; d->tmax = tmax;
+    d->nrecs = N;
+    d->tsize = cols[C_TIMES].len;
+    d->psize = cols[C_PORTS].len;
+    d->lsize = cols[C_LENS].len;
+    d->dsize = z->len;
+    d->rawsize = cols[C_DATA].len;
+    uint64_t total = (uint64_t)d->tsize + d->psize + d->lsize + d->dsize;
+    // chunks are written in order of conversion, directory keeps order of logs
+    d->offset = __atomic_fetch_add(&outoff, total, __ATOMIC_RELAXED);
+    uint64_t o = d->offset;
+    write_all(cols[C_TIMES].buf, d->tsize, o); o += d->tsize;
+    write_all(cols[C_PORTS].buf, d->psize, o); o += d->psize;
+    write_all(cols[C_LENS].buf, d->lsize, o); o += d->lsize;
+    write_all(z->buf, d->dsize, o);
+}
+
+static void *worker(_U_ void *arg){
+    column cols[C_AMOUNT] = {0};
+    size_t i;
+    while((i = __atomic_fetch_add(&nextjob, 1, __ATOMIC_RELAXED)) < njobs)
+        convert(&jobs[i], cols);
+    for(int c = 0; c < C_AMOUNT; ++c) FREE(cols[c].buf);
+    return NULL;
+}
+
+/**
+ * Split time ranges of logs into jobs by index entries
+ * @return FALSE if output can't have absolute times
+ */
+static int make_jobs(logsrc **src, int nsrc, double *t0){
+    int absolute = TRUE;
+    *t0 = 0.;
+    for(int i = 0; i < nsrc; ++i){
+        logidx_hdr *h = &src[i]->idx->hdr;
+        if(!(h->flags & IDX_ABSTIME) && h->t0 < 1.) absolute = FALSE;
+        if(h->t0 >= 1. && (*t0 < 1. || h->t0 < *t0)) *t0 = h->t0;
+    }
+    if(!absolute) *t0 = 0.;
+    for(int i = 0; i < nsrc; ++i){
+        logsrc *s = src[i];
+        logrec r;
+        // file of other port
+        if(log_getrec(s->map, 0, &r) && !r.port && !portmatch(s->port, strlen(s->port), selports))
+            continue;
+        logidx *idx = s->idx;
+        double dt = (absolute && !(idx->hdr.flags & IDX_ABSTIME)) ? idx->hdr.t0 : 0.;
+        size_t cur = logidx_find(idx, s->ts), end = logidx_after(idx, s->te, s->map->len);
+        if(end <= cur) continue;
+        for(size_t e = 0; e < idx->N; ++e){
+            size_t off = idx->entries[e].offset;
+            if(off >= end) break;
+            if(off > cur && off - cur >= COL_CHUNKSZ){
+                add_job(s, cur, off, dt);
+                cur = off;
+            }
+        }
+        add_job(s, cur, end, dt);
+    }
+    return absolute;
+}
+
+/**
+ * Convert records of logs into columnar file (chunks are converted in parallel)
+ * @param src      - opened logs with time ranges
+ * @param nsrc     - their amount
+ * @param ports    - NULL-terminated list of ports selected or NULL
+ * @param nthreads - amount of workers
+ * @param outname  - output file name
+ * @return amount of records exported or -1 in case of error
+ */
+long long col_export(logsrc **src, int nsrc, char **ports, int nthreads, const char *outname){
+    if(!src || nsrc < 1 || !outname) return -1;
+    outfd = open(outname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(outfd < 0){
+        WARN(_("Can't open %s"), outname);
+        return -1;
+    }
+    selports = ports;
+    failed = 0;
+    colhdr hdr = {.magick = COL_MAGICK};
+    if(make_jobs(src, nsrc, &hdr.t0)) hdr.flags = IDX_ABSTIME;
+    outoff = sizeof(colhdr);
+    if(nthreads < 1) nthreads = 1;
+    if((size_t)nthreads > njobs) nthreads = (int)njobs;
+    DBG("%zd chunks, %d threads", njobs, nthreads);
+    if(nthreads > 1){
+        pthread_t *threads = MALLOC(pthread_t, nthreads);
+        for(int i = 0; i < nthreads; ++i)
+            if(pthread_create(&threads[i], NULL, worker, NULL)) ERR(_("Can't create thread"));
+        for(int i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+        FREE(threads);
+    }else worker(NULL);
+    // directory: port names, padding & entries of non-empty chunks
+    column dir = {0};
+    for(uint32_t i = 0; i < ncports; ++i) col_add(&dir, cports[i], strlen(cports[i]) + 1);
+    static const char pad[8] = {0};
+    col_add(&dir, pad, (8 - (outoff + dir.len) % 8) % 8);
+    long long N = 0;
+    for(size_t i = 0; i < njobs; ++i){
+        if(!jobs[i].dir.nrecs) continue;
+        col_add(&dir, (const char*)&jobs[i].dir, sizeof(colchunk));
+        ++hdr.nchunks;
+        N += jobs[i].dir.nrecs;
+    }
+    hdr.nports = ncports;
+    hdr.diroff = outoff;
+    write_all(dir.buf, dir.len, outoff);
+    write_all((const char*)&hdr, sizeof(hdr), 0);
+    if(close(outfd)){
+        WARN(_("Can't write columnar file"));
+        failed = 1;
+    }
+    outfd = -1;
+    FREE(dir.buf);
+    for(uint32_t i = 0; i < ncports; ++i) FREE(cports[i]);
+    FREE(cports);
+    ncports = cportssz = 0;
+    FREE(jobs);
+    njobs = jobssz = nextjob = 0;
+    return failed ? -1 : N;
+}
+
+/**
+ * Check if file is a columnar file
+ * @return TRUE if it starts with COL_MAGICK
+ */
+int col_check(char *name){
+    char magick[8];
+    int fd = open(name, O_RDONLY);
+    if(fd < 0) return FALSE;
+    int ret = (read(fd, magick, 8) == 8 && !strncmp(magick, COL_MAGICK, 8));
+    close(fd);
+    return ret;
+}
+
+/**
+ * Open columnar file & check its directory
+ * @param name - filename
+ * @return opened file or NULL
+ */
+colfile *col_open(char *name){
+    mmapbuf *b = My_mmap(name);
+    if(!b) return NULL;
+    colhdr *hdr = (colhdr*)b->data;
+    if(b->len < sizeof(colhdr) || strncmp(hdr->magick, COL_MAGICK, 8) || hdr->diroff > b->len){
+        WARNX(_("%s isn't a columnar file"), name);
+        My_munmap(b);
+        return NULL;
+    }
+    colfile *c = MALLOC(colfile, 1);
+    c->map = b;
+    c->hdr = hdr;
+    size_t off = hdr->diroff;
+    uint32_t i = 0;
+    if(hdr->nports <= b->len - off){ // each name takes at least 1 byte
+        c->ports = MALLOC(char*, hdr->nports + 1);
+        for(; i < hdr->nports; ++i){
+            const char *e = off < b->len ? memchr(b->data + off, 0, b->len - off) : NULL;
+            if(!e) break;
+            c->ports[i] = b->data + off;
+            off = e + 1 - b->data;
+        }
+    }
+    off = (off + 7) & ~(size_t)7;
+    if(i < hdr->nports){
+        WARNX(_("%s: broken port names"), name);
+        col_close(&c);
+        return NULL;
+    }
+    if(off > b->len || (b->len - off) / sizeof(colchunk) < hdr->nchunks){
+        WARNX(_("%s: broken directory"), name);
+        col_close(&c);
+        return NULL;
+    }
+    c->dir = (colchunk*)(b->data + off);
+    return c;
+}
+
+// reading cursor of chunk (records of chunk are in order of their log)
+typedef struct{
+    colchunk *d;        // directory entry
+    uint64_t n;         // number of chunk
+    const char *tp, *pp, *lp, *zp;  // current positions in columns & compressed payloads
+    const char *tpe, *ppe, *lpe;    // ends of columns
+    uint32_t left;      // amount of records left
+    int64_t us;         // time of current record, us
+    uint64_t id;        // its port
+    uint64_t len;       // length of its payload
+    size_t doff;        // offset of payload in `raw`
+    size_t nextoff;     // offset of next payload
+    int unpacked;       // payloads are decompressed into `raw`
+    column raw;         // payloads
+} colcursor;
+
+// parameters of col_print()
+typedef struct{
+    colfile *c;
+    double ts, te;      // time range
+    const char *sel;    // flags of ports selected
+} colsel;
+
+/**
+ * Go to next record selected (payloads are decompressed at first of them)
+ * @return 1 if record found, 0 at the end of chunk, -1 if chunk is broken
+ */
+static int ccur_next(colcursor *k, colsel *s){
+    colchunk *d = k->d;
+    while(k->left){
+        uint64_t dt;
+        size_t l1 = get_varint(k->tp, k->tpe - k->tp, &dt), l2 = get_varint(k->pp, k->ppe - k->pp, &k->id),
+               l3 = get_varint(k->lp, k->lpe - k->lp, &k->len);
+        if(!l1 || !l2 || !l3 || k->len > d->rawsize - k->nextoff){
+            WARNX(_("Chunk %" PRIu64 " is broken"), k->n);
+            return -1;
+        }
+        k->tp += l1; k->pp += l2; k->lp += l3;
+        --k->left;
+        k->us += unzigzag(dt);
+        k->doff = k->nextoff;
+        k->nextoff += k->len;
+        double t = k->us / 1e6;
+        if(t < s->ts || t > s->te || k->id >= s->c->hdr->nports || !s->sel[k->id]) continue;
+        if(!k->unpacked){
+            uLongf L = d->rawsize;
+            col_reserve(&k->raw, L + 1);
+            if(uncompress((Bytef*)k->raw.buf, &L, (const Bytef*)k->zp, d->dsize) != Z_OK || L != d->rawsize){
+                WARNX(_("Chunk %" PRIu64 ": can't decompress payloads"), k->n);
+                return -1;
+            }
+            k->unpacked = TRUE;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Start reading of chunk
+ * @return 1 if it have records selected, 0 if not, -1 if it's broken
+ */
+static int ccur_start(colcursor *k, colsel *s){
+    colchunk *d = k->d;
+    mmapbuf *map = s->c->map;
+    uint64_t total = (uint64_t)d->tsize + d->psize + d->lsize + d->dsize;
+    if(d->offset > map->len || map->len - d->offset < total){
+        WARNX(_("Chunk %" PRIu64 " is out of file"), k->n);
+        return -1;
+    }
+    k->tp = map->data + d->offset;
+    k->pp = k->tpe = k->tp + d->tsize;
+    k->lp = k->ppe = k->pp + d->psize;
+    k->zp = k->lpe = k->lp + d->lsize;
+    k->left = d->nrecs;
+    return ccur_next(k, s);
+}
+
+static int cmp_tmin(const void *a, const void *b){
+    double ta = ((const colcursor*)a)->d->tmin, tb = ((const colcursor*)b)->d->tmin;
+    return (ta > tb) - (ta < tb);
+}
+
+static void cheap_down(colcursor **heap, int N, int i){
+    while(1){
+        int l = 2*i + 1, r = l + 1, m = i;
+        if(l < N && heap[l]->us < heap[m]->us) m = l;
+        if(r < N && heap[r]->us < heap[m]->us) m = r;
+        if(m == i) return;
+        colcursor *tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+static void cheap_up(colcursor **heap, int i){
+    while(i > 0){
+        int p = (i - 1) / 2;
+        if(heap[p]->us <= heap[i]->us) return;
+        colcursor *tmp = heap[i]; heap[i] = heap[p]; heap[p] = tmp;
+        i = p;
+    }
+}
+
+/**
+ * Print records of columnar file in given time range merged by time (chunks
+ * are read in order of their tmin, so only payloads of chunks overlapping in
+ * time are kept in memory; chunks without records selected aren't decompressed)
+ * @param c      - opened file
+ * @param ts     - start of time range
+ * @param te     - end of time range
+ * @param ports  - NULL-terminated list of ports selected or NULL
+ * @param out    - output stream
+ * @param rawout - output only payload
+ * @return amount of records printed or -1 in case of error
+ */
+long long col_print(colfile *c, double ts, double te, char **ports, FILE *out, int rawout){
+    if(!c || !out) return -1;
+    colhdr *hdr = c->hdr;
+    char *sel = MALLOC(char, hdr->nports + 1);
+    for(uint32_t i = 0; i < hdr->nports; ++i) sel[i] = (char)portmatch(c->ports[i], strlen(c->ports[i]), ports);
+    colsel s = {.c = c, .ts = ts, .te = te, .sel = sel};
+    colcursor *cur = MALLOC(colcursor, hdr->nchunks + 1), **heap = MALLOC(colcursor*, hdr->nchunks + 1);
+    int ncur = 0, N = 0;
+    for(uint64_t n = 0; n < hdr->nchunks; ++n){
+        colchunk *d = &c->dir[n];
+        if(d->nrecs == 0 || d->tmax < ts || d->tmin > te) continue;
+        cur[ncur].d = d;
+        cur[ncur++].n = n;
+    }
+    qsort(cur, ncur, sizeof(colcursor), cmp_tmin);
+    long long nrec = 0;
+    int next = 0;
+    while(1){
+        // start chunks which can have records before current one (1us: rounding of times)
+        while(next < ncur && (!N || cur[next].d->tmin - 1e-6 <= heap[0]->us / 1e6)){
+            colcursor *k = &cur[next++];
+            int r = ccur_start(k, &s);
+            if(r < 0){ nrec = -1; break; }
+            if(r == 0) continue;
+            heap[N] = k;
+            cheap_up(heap, N++);
+        }
+        if(nrec < 0 || !N) break;
+        colcursor *k = heap[0];
+        if(!rawout) fprintf(out, "%g: %s\n", k->us / 1e6, c->ports[k->id]);
+        fwrite(k->raw.buf + k->doff, 1, k->len, out);
+        fputc('\n', out);
+        ++nrec;
+        int r = ccur_next(k, &s);
+        if(r < 0){ nrec = -1; break; }
+        if(r == 0){
+            FREE(k->raw.buf);
+            heap[0] = heap[--N];
+        }
+        cheap_down(heap, N, 0);
+    }
+    for(int i = 0; i < ncur; ++i) FREE(cur[i].raw.buf);
+    FREE(cur); FREE(heap);
+    FREE(sel);
+    return nrec;
+}
+
+void col_close(colfile **c){
+    if(!c || !*c) return;
+    My_munmap((*c)->map);
+    FREE((*c)->ports);
+    FREE(*c);
+}
@@ -0,0 +1,81 @@
+/*
+ * colfile.h - columnar chunked export of logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __COLFILE_H__
+#define __COLFILE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "query.h"
+
+/*
+ * Columnar file: header, chunks of columns & directory (at `diroff`):
+ * NUL-terminated port names (port id is their number), padding to 8 bytes and
+ * `colchunk` entry per chunk. Chunk contains columns of its records one after
+ * another: times (zigzag varint of delta from previous time, us; first - from 0),
+ * port ids (varint), payload lengths (varint) & payloads (without '\n')
+ * compressed by zlib as a single blob. Chunks of different logs are
+ * independent, so their time ranges can overlap: use tmin/tmax of directory.
+ */
+
+// columnar file magick
+#define COL_MAGICK      "MTCOL01"
+// amount of log data (bytes) converted into one chunk
+#define COL_CHUNKSZ     (4<<20)
+// compression level of payloads (speed is more important)
+#define COL_ZLEVEL      (1)
+
+typedef struct{
+    char magick[8];     // COL_MAGICK
+    uint32_t flags;     // IDX_ABSTIME if times are UNIX times
+    uint32_t nports;    // amount of port names
+    double t0;          // UNIX time of capture start (0 if unknown)
+    uint64_t nchunks;   // amount of chunks
+    uint64_t diroff;    // offset of directory
+} colhdr;
+
+typedef struct{
+    double tmin;        // min & max time of records
+    double tmax;
+    uint64_t offset;    // offset of chunk's columns
+    uint32_t nrecs;     // amount of records
+    uint32_t tsize;     // size of times column
+    uint32_t psize;     // size of ports column
+    uint32_t lsize;     // size of lengths column
+    uint32_t dsize;     // size of compressed payloads
+    uint32_t rawsize;   // size of payloads uncompressed
+} colchunk;
+
+// opened columnar file
+typedef struct{
+    mmapbuf *map;       // mmaped file
+    colhdr *hdr;        // its header
+    char **ports;       // port names
+    colchunk *dir;      // directory
+} colfile;
+
+int col_check(char *name);
+long long col_export(logsrc **src, int nsrc, char **ports, int nthreads, const char *outname);
+colfile *col_open(char *name);
+long long col_print(colfile *c, double ts, double te, char **ports, FILE *out, int rawout);
+void col_close(colfile **c);
+
+#endif // __COLFILE_H__
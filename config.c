@@ -0,0 +1,293 @@
+/*
+ * config.c - configuration file with per-port settings
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "decode.h"
+#include "encode.h"
+#include "parseargs.h"
+#include "rtsched.h"
+#include "usefull_macros.h"
+
+// values of current section
+static int c_speed, c_bufsize, c_latency, c_timing, c_dedup;
+static ratelimit c_limit;
+static char *c_framing, *c_framer, *c_log, *c_decoder, *c_encoding, *c_cpu;
+
+static mysuboption cfgopts[] = {
+    {"baudrate",NEED_ARG,   arg_int,    &c_speed},
+    {"framing", NEED_ARG,   arg_string, &c_framing},
+    {"framer",  NEED_ARG,   arg_string, &c_framer},
+    {"bufsize", NEED_ARG,   arg_int,    &c_bufsize},
+    {"log",     NEED_ARG,   arg_string, &c_log},
+    {"latency", NEED_ARG,   arg_int,    &c_latency},
+    {"timing",  NEED_ARG,   arg_int,    &c_timing},
+    {"decoder", NEED_ARG,   arg_string, &c_decoder},
+    {"encoding",NEED_ARG,   arg_string, &c_encoding},
+    {"dedup",   NEED_ARG,   arg_int,    &c_dedup},
+    {"limit_bytes", NEED_ARG, arg_int,  &c_limit.bytes},
+    {"limit_recs",  NEED_ARG, arg_int,  &c_limit.recs},
+    {"limit_sample",NEED_ARG, arg_int,  &c_limit.sample},
+    {"limit_full",  NEED_ARG, arg_int,  &c_limit.full},
+    {"cpu",     NEED_ARG,   arg_string, &c_cpu},
+    end_suboption
+};
+
+// remove leading & trailing spaces
+static char *trim(char *str){
+    while(isspace(*str)) ++str;
+    char *e = str + strlen(str);
+    while(e > str && isspace(e[-1])) --e;
+    *e = 0;
+    return str;
+}
+
+// fill current section values from port settings
+static void cfg_set(const portcfg *p){
+    c_speed = p->speed;
+    c_bufsize = p->bufsize;
+    c_latency = p->latency;
+    c_timing = p->timing;
+    c_dedup = p->dedup;
+    c_limit = p->limit;
+    c_framing = p->framing ? strdup(p->framing) : NULL;
+    c_framer = strdup(p->charmode ? "char" : "line");
+    c_log = NULL;
+    c_decoder = p->decoder ? strdup(p->decoder) : NULL;
+    c_encoding = strdup(enc_name(p->encoding));
+    c_cpu = p->cpus ? strdup(p->cpus) : NULL;
+}
+
+/**
+ * check values of current section & store them into `p`
+ * @return amount of errors
+ */
+static int cfg_check(const char *filename, int line, portcfg *p){
+    int nerr = 0;
+    if(!get_bspeed(c_speed)){
+        WARNX(_("%s:%d: wrong baudrate %d"), filename, line, c_speed);
+        ++nerr;
+    }
+    if(framing2cflag(c_framing, NULL)){
+        WARNX(_("%s:%d: wrong framing %s"), filename, line, c_framing);
+        ++nerr;
+    }
+    int charmode = 0;
+    if(c_framer && strcasecmp(c_framer, "char") == 0) charmode = 1;
+    else if(!c_framer || strcasecmp(c_framer, "line")){
+        WARNX(_("%s:%d: wrong framer %s (should be line or char)"), filename, line, c_framer ? c_framer : "");
+        ++nerr;
+    }
+    if(c_bufsize < CFG_MINBUFSZ || c_bufsize > CFG_MAXBUFSZ){
+        WARNX(_("%s:%d: buffer size should be from %d to %d"), filename, line, CFG_MINBUFSZ, CFG_MAXBUFSZ);
+        ++nerr;
+    }
+    if(c_decoder && strcasecmp(c_decoder, "none") == 0) FREE(c_decoder);
+    if(c_decoder && !decoder_exists(c_decoder)){
+        WARNX(_("%s:%d: wrong decoder %s"), filename, line, c_decoder);
+        ++nerr;
+    }
+    int encoding = c_encoding ? enc_byname(c_encoding) : -1;
+    if(encoding < 0){
+        WARNX(_("%s:%d: wrong encoding %s"), filename, line, c_encoding ? c_encoding : "");
+        ++nerr;
+        encoding = ENC_RAW;
+    }
+    if(c_latency < 0){
+        WARNX(_("%s:%d: latency can't be negative"), filename, line);
+        ++nerr;
+    }
+    if(c_dedup < 0){
+        WARNX(_("%s:%d: dedup time can't be negative"), filename, line);
+        ++nerr;
+    }
+    if(c_limit.bytes < 0 || c_limit.recs < 0 || c_limit.sample < 0){
+        WARNX(_("%s:%d: rate limits can't be negative"), filename, line);
+        ++nerr;
+    }
+    if(c_cpu && strcasecmp(c_cpu, "none") == 0) FREE(c_cpu);
+    if(c_cpu && rt_checkcpus(c_cpu)){
+        WARNX(_("%s:%d: wrong CPU %s"), filename, line, c_cpu);
+        ++nerr;
+    }
+    p->speed = c_speed;
+    p->latency = c_latency;
+    p->timing = c_timing;
+    p->dedup = c_dedup;
+    p->limit = c_limit;
+    FREE(p->framing);
+    p->framing = c_framing;
+    p->charmode = charmode;
+    p->bufsize = c_bufsize;
+    FREE(p->logname);
+    p->logname = c_log;
+    FREE(p->decoder);
+    p->decoder = c_decoder;
+    p->encoding = encoding;
+    FREE(p->cpus);
+    p->cpus = c_cpu;
+    FREE(c_framer);
+    FREE(c_encoding);
+    c_framing = NULL; c_log = NULL; c_decoder = NULL; c_cpu = NULL;
+    return nerr;
+}
+
+/**
+ * Free strings of single port's settings
+ */
+void portcfg_clear(portcfg *p){
+    FREE(p->name);
+    FREE(p->framing);
+    FREE(p->logname);
+    FREE(p->decoder);
+    FREE(p->cpus);
+}
+
+/**
+ * Free array of ports' settings
+ */
+void portcfg_free(portcfg *ports, int nports){
+    if(!ports) return;
+    for(int i = 0; i < nports; ++i) portcfg_clear(&ports[i]);
+    FREE(ports);
+}
+
+/**
+ * Read configuration file & add its ports to array `ports`
+ * all errors are reported at once
+ * @param filename - name of file
+ * @param defaults - default settings (from command line)
+ * @param ports    - array of ports (would be reallocated or freed in case of error) or NULL
+ * @param nports (io) - amount of ports in `ports`
+ * @return new array of ports or NULL if there was errors
+ */
+portcfg *read_config(const char *filename, const portcfg *defaults, portcfg *ports, int *nports){
+    FILE *f = fopen(filename, "r");
+    if(!f){
+        WARN(_("Can't open %s"), filename);
+        portcfg_free(ports, *nports);
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t bufsz = 0;
+    int nerr = 0, line = 0, secline = 1, N = *nports, Nmax = N;
+    portcfg glob = *defaults, *cur = &glob;
+    glob.framing = defaults->framing ? strdup(defaults->framing) : NULL;
+    glob.logname = NULL;
+    glob.decoder = defaults->decoder ? strdup(defaults->decoder) : NULL;
+    glob.cpus = defaults->cpus ? strdup(defaults->cpus) : NULL;
+    cfg_set(&glob);
+    while(getline(&buf, &bufsz, f) > 0){
+        ++line;
+        char *str = trim(buf);
+        if(!*str || *str == '#' || *str == ';') continue;
+        if(*str == '['){ // new section
+            char *e = strchr(str, ']');
+            if(!e || e == str + 1){
+                WARNX(_("%s:%d: wrong section name"), filename, line);
+                ++nerr;
+                continue;
+            }
+            nerr += cfg_check(filename, secline, cur);
+            *e = 0;
+            str = trim(str + 1);
+            for(int i = 0; i < N; ++i) if(strcmp(ports[i].name, str) == 0){
+                WARNX(_("%s:%d: port %s already defined"), filename, line, str);
+                ++nerr;
+                break;
+            }
+            if(N == Nmax){
+                Nmax += 64;
+                ports = realloc(ports, Nmax * sizeof(portcfg));
+                if(!ports) ERR("realloc()");
+            }
+            cur = &ports[N++];
+            *cur = glob;
+            cur->name = strdup(str);
+            cur->framing = NULL;
+            cur->logname = NULL;
+            cur->decoder = NULL;
+            cur->cpus = NULL;
+            cfg_set(&glob);
+            secline = line;
+            continue;
+        }
+        char *eq = strchr(str, '=');
+        if(!eq){
+            WARNX(_("%s:%d: should be 'key = value'"), filename, line);
+            ++nerr;
+            continue;
+        }
+        // make "key=value" for get_suboption()
+        *eq = 0;
+        char *key = trim(str), *val = trim(eq + 1);
+        if(strpbrk(val, ":,")){
+            WARNX(_("%s:%d: value shouldn't contain ':' or ','"), filename, line);
+            ++nerr;
+            continue;
+        }
+        char kv[strlen(key) + strlen(val) + 2];
+        sprintf(kv, "%s=%s", key, val);
+        // string parameters are replaced only if new value is parsed
+        char **sp = NULL;
+        if(strcasecmp(key, "framing") == 0) sp = &c_framing;
+        else if(strcasecmp(key, "framer") == 0) sp = &c_framer;
+        else if(strcasecmp(key, "decoder") == 0) sp = &c_decoder;
+        else if(strcasecmp(key, "encoding") == 0) sp = &c_encoding;
+        else if(strcasecmp(key, "cpu") == 0) sp = &c_cpu;
+        else if(strcasecmp(key, "log") == 0){
+            if(cur == &glob){
+                WARNX(_("%s:%d: log name can't be common for all ports"), filename, line);
+                ++nerr;
+                continue;
+            }
+            sp = &c_log;
+        }
+        char *old = NULL;
+        if(sp){
+            old = *sp;
+            *sp = NULL;
+        }
+        if(!get_suboption(kv, cfgopts)){
+            WARNX(_("%s:%d: wrong line"), filename, line);
+            ++nerr;
+            if(sp){ // keep previous value
+                FREE(*sp);
+                *sp = old;
+            }
+        }else if(sp) FREE(old);
+    }
+    nerr += cfg_check(filename, secline, cur);
+    FREE(glob.framing);
+    FREE(glob.decoder);
+    FREE(glob.cpus);
+    FREE(buf);
+    fclose(f);
+    if(nerr){
+        WARNX(_("%d error[s] in %s"), nerr, filename);
+        portcfg_free(ports, N);
+        return NULL;
+    }
+    *nports = N;
+    return ports;
+}
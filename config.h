@@ -0,0 +1,53 @@
+/*
+ * config.h - configuration file with per-port settings
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include "term.h"
+
+/*
+ * Configuration file is INI-like:
+ *      # comment
+ *      baudrate = 115200       ; keys before first section are defaults for all ports
+ *      [/dev/ttyUSB0]          ; section name is port device
+ *      framing = 7E1
+ *      log = /var/log/usb0.txt
+ * Keys: baudrate, framing (like 8N1), framer (line or char), bufsize, log,
+ *      latency (max time in ms data can wait in output buffers, 0 - write at once),
+ *      timing (1 - write times of data chunks into timing file),
+ *      decoder (modbus, nmea, slip, cobs or none),
+ *      encoding (of data in stdout & socket outputs: raw, hex, escape or base64),
+ *      dedup (max time in s of collapsing repeated records into "last line repeated N times", 0 - off),
+ *      limit_bytes, limit_recs (rate limit of port's records: bytes/s, records/s; 0 - no limit),
+ *      limit_sample (pass each N-th record over limit), limit_full (1 - limit only shared outputs),
+ *      cpu (CPU or range like 2-3 of capture thread, "none" - CPUs of command line).
+ */
+
+// limits of line buffer size
+#define CFG_MINBUFSZ    (16)
+#define CFG_MAXBUFSZ    (1<<20)
+
+portcfg *read_config(const char *filename, const portcfg *defaults, portcfg *ports, int *nports);
+void portcfg_clear(portcfg *p);
+void portcfg_free(portcfg *ports, int nports);
+
+#endif // __CONFIG_H__
@@ -0,0 +1,282 @@
+/*
+ * decode.c - protocol decoders of ports' data (Modbus RTU, NMEA, SLIP, COBS)
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <float.h>
+#include <pthread.h>
+#include "decode.h"
+#include "usefull_macros.h"
+
+// amount of frame bytes shown in summary
+#define DEC_SHOWBYTES   (16)
+// min silence between Modbus frames on fast ports (s)
+#define MODBUS_MINSILENCE (1.75e-3)
+
+// CRC16 (Modbus: reflected poly 0xA001, init 0xFFFF), table built at first use
+static uint16_t crc16tbl[256];
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+static void crc16_init(){
+    for(int i = 0; i < 256; ++i){
+        uint16_t c = (uint16_t)i;
+        for(int j = 0; j < 8; ++j) c = (c & 1) ? (c >> 1) ^ 0xA001 : c >> 1;
+        crc16tbl[i] = c;
+    }
+}
+
+static uint16_t crc16(const uint8_t *buf, size_t len){
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < len; ++i) crc = (crc >> 8) ^ crc16tbl[(crc ^ buf[i]) & 0xff];
+    return crc;
+}
+
+/**
+ * Print first bytes of frame as hex
+ * @return amount of symbols printed
+ */
+static size_t hexbytes(char *out, size_t sz, const uint8_t *buf, size_t len){
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0, L = len > DEC_SHOWBYTES ? DEC_SHOWBYTES : len;
+    for(size_t i = 0; i < L && n + 4 < sz; ++i){
+        out[n++] = ' ';
+        out[n++] = hex[buf[i] >> 4];
+        out[n++] = hex[buf[i] & 0xf];
+    }
+    if(L < len && n + 4 < sz){
+        memcpy(out + n, " ...", 4);
+        n += 4;
+    }
+    out[n] = 0;
+    return n;
+}
+
+// emit summary & start new frame
+static void frame_done(decoder *d, int good, double t, dec_emit emit, void *arg, const char *fmt, ...){
+    char buf[DEC_MAXSUMMARY];
+    va_list ar;
+    va_start(ar, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ar);
+    va_end(ar);
+    if(n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+    if(good) ++d->frames;
+    else ++d->errors;
+    emit(t, buf, n, arg);
+    d->flen = 0;
+    d->overflow = 0;
+    d->state = 0;
+}
+
+// add byte to frame
+static inline void frame_add(decoder *d, uint8_t c, double t){
+    if(!d->flen && !d->overflow) d->tframe = t;
+    if(d->flen < DEC_MAXFRAME) d->frame[d->flen++] = c;
+    else d->overflow = 1;
+}
+
+/* Modbus RTU: slave, function, data, CRC16 (LSB first); frames are ended by silence */
+static void modbus_byte(decoder *d, uint8_t c, double t, _U_ dec_emit emit, _U_ void *arg){
+    frame_add(d, c, t);
+}
+static void modbus_end(decoder *d, dec_emit emit, void *arg){
+    char hex[DEC_SHOWBYTES * 3 + 8];
+    const uint8_t *f = d->frame;
+    size_t L = d->flen;
+    hexbytes(hex, sizeof(hex), f, L);
+    if(d->overflow){
+        frame_done(d, 0, d->tframe, emit, arg, "modbus: frame too long:%s", hex);
+        return;
+    }
+    if(L < 4){
+        frame_done(d, 0, d->tframe, emit, arg, "modbus: short frame:%s", hex);
+        return;
+    }
+    uint16_t crc = crc16(f, L - 2), got = f[L-2] | (f[L-1] << 8);
+    if(crc != got)
+        frame_done(d, 0, d->tframe, emit, arg, "modbus: CRC error (got %04X, calculated %04X):%s", got, crc, hex);
+    else if(f[1] & 0x80)
+        frame_done(d, 1, d->tframe, emit, arg, "modbus: slave %u, exception %u of function %u", f[0], f[2], f[1] & 0x7f);
+    else
+        frame_done(d, 1, d->tframe, emit, arg, "modbus: slave %u, function %u, %zd bytes:%s", f[0], f[1], L, hex);
+}
+
+/* NMEA 0183: "$talker,fields*HH\r\n" (or starting with '!'), checksum is XOR of bytes between '$' and '*' */
+static int hexval(uint8_t c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+static void nmea_byte(decoder *d, uint8_t c, double t, dec_emit emit, void *arg){
+    if(c == '$' || c == '!'){ // start of sentence (previous one is lost if it wasn't ended)
+        if(d->flen) frame_done(d, 0, d->tframe, emit, arg, "nmea: unterminated sentence %.*s",
+            (int)(d->flen > 16 ? 16 : d->flen), (char*)d->frame);
+        frame_add(d, c, t);
+        return;
+    }
+    if(!d->flen) return; // garbage between sentences
+    if(c != '\r' && c != '\n'){
+        frame_add(d, c, t);
+        return;
+    }
+    const char *s = (const char*)d->frame;
+    size_t L = d->overflow ? 0 : d->flen;
+    const char *star = memchr(s, '*', L);
+    size_t namelen = 0;
+    while(namelen + 1 < L && s[namelen + 1] != ',' && s[namelen + 1] != '*') ++namelen;
+    int nfields = 1;
+    for(size_t i = 1; i < (star ? (size_t)(star - s) : L); ++i) if(s[i] == ',') ++nfields;
+    if(!L) frame_done(d, 0, d->tframe, emit, arg, "nmea: sentence too long");
+    else if(!star) frame_done(d, 1, d->tframe, emit, arg, "nmea: %.*s, %d fields, no checksum", (int)namelen, s + 1, nfields);
+    else{
+        uint8_t sum = 0;
+        for(const char *p = s + 1; p < star; ++p) sum ^= (uint8_t)*p;
+        int h = (star + 2 < s + L) ? hexval(star[1]) : -1, l = h < 0 ? -1 : hexval(star[2]);
+        if(l < 0) frame_done(d, 0, d->tframe, emit, arg, "nmea: %.*s, wrong checksum field", (int)namelen, s + 1);
+        else if((h << 4 | l) != sum) frame_done(d, 0, d->tframe, emit, arg, "nmea: %.*s, checksum error (got %02X, calculated %02X)",
+            (int)namelen, s + 1, h << 4 | l, sum);
+        else frame_done(d, 1, d->tframe, emit, arg, "nmea: %.*s, %d fields", (int)namelen, s + 1, nfields);
+    }
+}
+
+/* SLIP (RFC 1055): END 0xC0 delimits frames, ESC 0xDB: ESC_END 0xDC, ESC_ESC 0xDD */
+#define SLIP_END        (0xC0)
+#define SLIP_ESC        (0xDB)
+#define SLIP_ESC_END    (0xDC)
+#define SLIP_ESC_ESC    (0xDD)
+static void slip_byte(decoder *d, uint8_t c, double t, dec_emit emit, void *arg){
+    if(c == SLIP_END){
+        if(!d->flen && !d->overflow && d->state >= 0){ d->state = 0; return; } // empty frame
+        char hex[DEC_SHOWBYTES * 3 + 8];
+        hexbytes(hex, sizeof(hex), d->frame, d->flen);
+        if(d->overflow) frame_done(d, 0, d->tframe, emit, arg, "slip: frame too long:%s", hex);
+        else if(d->state < 0) frame_done(d, 0, d->tframe, emit, arg, "slip: wrong escape, %zd bytes:%s", d->flen, hex);
+        else frame_done(d, 1, d->tframe, emit, arg, "slip: %zd bytes:%s", d->flen, hex);
+        return;
+    }
+    if(d->state == 1){ // after ESC
+        d->state = 0;
+        if(c == SLIP_ESC_END) c = SLIP_END;
+        else if(c == SLIP_ESC_ESC) c = SLIP_ESC;
+        else d->state = -1; // error: mark frame as bad
+    }else if(c == SLIP_ESC){
+        if(d->state == 0) d->state = 1;
+        return;
+    }
+    frame_add(d, c, t);
+}
+
+/* COBS: zero byte delimits frames, each block starts with code: offset of next zero */
+static void cobs_byte(decoder *d, uint8_t c, double t, dec_emit emit, void *arg){
+    if(c){
+        frame_add(d, c, t);
+        return;
+    }
+    if(!d->flen && !d->overflow) return;
+    // decode in place: output is always shorter than input
+    uint8_t *f = d->frame;
+    size_t in = 0, out = 0, L = d->flen;
+    int bad = d->overflow;
+    while(!bad && in < L){
+        uint8_t code = f[in++];
+        if(in + code - 1 > L){ bad = 1; break; }
+        for(int i = 1; i < code; ++i) f[out++] = f[in++];
+        if(code < 0xff && in < L) f[out++] = 0;
+    }
+    char hex[DEC_SHOWBYTES * 3 + 8];
+    hexbytes(hex, sizeof(hex), f, bad ? L : out);
+    if(d->overflow) frame_done(d, 0, d->tframe, emit, arg, "cobs: frame too long:%s", hex);
+    else if(bad) frame_done(d, 0, d->tframe, emit, arg, "cobs: wrong block length, %zd bytes:%s", L, hex);
+    else frame_done(d, 1, d->tframe, emit, arg, "cobs: %zd bytes:%s", out, hex);
+}
+
+static const decoder_ops decoders[] = {
+    {"modbus",  modbus_byte,    modbus_end},
+    {"nmea",    nmea_byte,      NULL},
+    {"slip",    slip_byte,      NULL},
+    {"cobs",    cobs_byte,      NULL},
+    {NULL, NULL, NULL}
+};
+
+static const decoder_ops *find_ops(const char *name){
+    for(const decoder_ops *o = decoders; o->name; ++o)
+        if(strcasecmp(o->name, name) == 0) return o;
+    return NULL;
+}
+
+/**
+ * Check name of decoder
+ * @return 1 if decoder exists
+ */
+int decoder_exists(const char *name){
+    return find_ops(name) != NULL;
+}
+
+/**
+ * Create decoder
+ * @param name     - protocol name (modbus, nmea, slip or cobs)
+ * @param chartime - transmission time of character, s
+ * @return decoder or NULL if there's no such protocol
+ */
+decoder *decoder_new(const char *name, double chartime){
+    const decoder_ops *ops = find_ops(name);
+    if(!ops) return NULL;
+    pthread_once(&crc16_once, crc16_init); // ports are opened by several threads
+    decoder *d = MALLOC(decoder, 1);
+    d->ops = ops;
+    d->chartime = chartime;
+    d->silence = 3.5 * chartime;
+    if(d->silence < MODBUS_MINSILENCE) d->silence = MODBUS_MINSILENCE;
+    return d;
+}
+
+/**
+ * Feed data read from port into decoder
+ * @param d    - decoder
+ * @param buf  - data
+ * @param len  - its length
+ * @param t    - time when data was read (of its last byte)
+ * @param emit - function called for each frame
+ * @param arg  - its argument
+ */
+void decoder_feed(decoder *d, const char *buf, size_t len, double t, dec_emit emit, void *arg){
+    double tb = t - (len - 1) * d->chartime; // time of first byte
+    if(d->ops->end && (d->flen || d->overflow) && tb - d->tlast > d->silence) d->ops->end(d, emit, arg);
+    for(size_t i = 0; i < len; ++i, tb += d->chartime)
+        d->ops->byte(d, (uint8_t)buf[i], tb, emit, arg);
+    d->tlast = t;
+}
+
+/**
+ * @return time when pending frame would be ended by silence or DBL_MAX
+ */
+double decoder_deadline(const decoder *d){
+    if(!d->ops->end || !(d->flen || d->overflow)) return DBL_MAX;
+    return d->tlast + d->silence;
+}
+
+/**
+ * End pending frame if there was silence till time `t` (DBL_MAX - at once)
+ */
+void decoder_idle(decoder *d, double t, dec_emit emit, void *arg){
+    if(d->ops->end && (d->flen || d->overflow) && t >= decoder_deadline(d)) d->ops->end(d, emit, arg);
+}
+
+void decoder_free(decoder **d){
+    FREE(*d);
+}
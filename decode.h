@@ -0,0 +1,75 @@
+/*
+ * decode.h - protocol decoders of ports' data (Modbus RTU, NMEA, SLIP, COBS)
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Decoder gets raw data of port as it's read (so frames are found whatever
+ * framer is used), collects frames, checks them & makes one-line summary of
+ * each frame. Modbus RTU frames are ended by silence of 3.5 characters, other
+ * protocols have delimiters.
+ */
+
+// suffix of file with summaries of frames
+#define DEC_SUFFIX      ".dec"
+// max length of frame & summary
+#define DEC_MAXFRAME    (1024)
+#define DEC_MAXSUMMARY  (256)
+
+typedef struct decoder decoder;
+
+// called for each frame: its time (of first byte), summary & its length
+typedef void (*dec_emit)(double t, const char *summary, size_t len, void *arg);
+
+typedef struct{
+    const char *name;
+    // process single byte
+    void (*byte)(decoder *d, uint8_t c, double t, dec_emit emit, void *arg);
+    // process end of frame (by silence) - NULL for protocols with delimiters
+    void (*end)(decoder *d, dec_emit emit, void *arg);
+} decoder_ops;
+
+struct decoder{
+    const decoder_ops *ops;
+    uint8_t frame[DEC_MAXFRAME]; // current frame
+    size_t flen;        // its length
+    int state;          // decoder-specific state (escape etc)
+    int overflow;       // frame was too long
+    double tframe;      // time of first byte of frame
+    double tlast;       // time of last byte
+    double chartime;    // transmission time of character (s)
+    double silence;     // silence between frames (s)
+    uint64_t frames;    // amount of good frames
+    uint64_t errors;    // amount of bad frames (CRC, checksum, escapes)
+};
+
+int decoder_exists(const char *name);
+decoder *decoder_new(const char *name, double chartime);
+void decoder_feed(decoder *d, const char *buf, size_t len, double t, dec_emit emit, void *arg);
+double decoder_deadline(const decoder *d);
+void decoder_idle(decoder *d, double t, dec_emit emit, void *arg);
+void decoder_free(decoder **d);
+
+#endif // __DECODE_H__
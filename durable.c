@@ -0,0 +1,223 @@
+/*
+ * durable.c - background syncing of logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include "durable.h"
+#include "parseargs.h"
+#include "usefull_macros.h"
+
+typedef enum{
+    DUR_NEVER,      // don't sync
+    DUR_INTERVAL,   // fdatasync() every N ms
+    DUR_BYTES,      // fdatasync() after every N bytes
+    DUR_RANGE       // sync_file_range() by windows of N bytes, fdatasync() at their boundaries
+} durpolicy;
+
+typedef struct{
+    int fd;             // own copy of descriptor or -1 if slot is free
+    int closing;        // owner closed file: sync it last time & close
+    uint64_t offset;    // amount of data written (set by capture thread)
+    // these are used only by sync thread
+    uint64_t synced;    // offset synced
+    uint64_t started;   // offset up to which writeback is started (DUR_RANGE)
+    double tsync;       // time of last sync
+} durfile;
+
+static durpolicy policy = DUR_NEVER;
+static uint64_t bytes = 0;     // DUR_BYTES & DUR_RANGE
+static int interval = 0;       // DUR_INTERVAL, ms
+static durfile files[DUR_MAXFILES];
+static int running = 0, stop = 0;
+static pthread_t thread;
+// ports are opened by several threads at start
+static pthread_mutex_t addmutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Parse policy: "ms=N" (sync every N ms), "mb=N" (sync after N MB written),
+ * "range=N" (sync_file_range() by windows of N MB) and "direct" (use O_DIRECT)
+ * @param policy - policy string
+ * @param direct (o) - O_DIRECT flag
+ * @return 0 if all OK
+ */
+int durable_setup(char *str, int *direct){
+    int ms = 0, mb = 0, range = 0;
+    mysuboption duropts[] = {
+        {"ms",      NEED_ARG,   arg_int,    &ms},
+        {"mb",      NEED_ARG,   arg_int,    &mb},
+        {"range",   NEED_ARG,   arg_int,    &range},
+        {"direct",  NO_ARGS,    arg_none,   direct},
+        end_suboption
+    };
+    if(!get_suboption(str, duropts)) return 1;
+    if(ms < 0 || mb < 0 || range < 0 || (ms > 0) + (mb > 0) + (range > 0) > 1){
+        WARNX(_("Only one of positive ms, mb or range should be given"));
+        return 1;
+    }
+    if(ms){ policy = DUR_INTERVAL; interval = ms; }
+    else if(mb){ policy = DUR_BYTES; bytes = (uint64_t)mb << 20; }
+    else if(range){ policy = DUR_RANGE; bytes = (uint64_t)range << 20; }
+    return 0;
+}
+
+static void syncfile(durfile *f, uint64_t offset, double now){
+    if(fdatasync(f->fd)) DBG("fdatasync() failed");
+    f->synced = offset;
+    f->tsync = now;
+}
+
+static void check_file(durfile *f){
+    int fd = __atomic_load_n(&f->fd, __ATOMIC_ACQUIRE);
+    if(fd < 0) return;
+    uint64_t offset = __atomic_load_n(&f->offset, __ATOMIC_ACQUIRE);
+    double now = dtime();
+    switch(policy){
+        case DUR_INTERVAL:
+            if(offset != f->synced && (now - f->tsync) * 1e3 >= interval) syncfile(f, offset, now);
+        break;
+        case DUR_BYTES:
+            if(offset - f->synced >= bytes) syncfile(f, offset, now);
+        break;
+        case DUR_RANGE:
+            if(offset - f->started >= bytes){
+                // start writeback of new window & wait for previous one
+                sync_file_range(fd, f->started, offset - f->started, SYNC_FILE_RANGE_WRITE);
+                if(f->started > f->synced){
+                    sync_file_range(fd, f->synced, f->started - f->synced,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                    // sync_file_range() doesn't write metadata (size of file) & doesn't flush
+                    // disk cache: fdatasync() makes previous window durable, its data is
+                    // already written, so it's cheap
+                    if(fdatasync(fd)) DBG("fdatasync() failed");
+                }
+                f->synced = f->started;
+                f->started = offset;
+            }
+        break;
+        default:
+        break;
+    }
+    if(__atomic_load_n(&f->closing, __ATOMIC_ACQUIRE)){
+        if(policy != DUR_NEVER) fdatasync(fd);
+        close(fd);
+        f->closing = 0;
+        __atomic_store_n(&f->fd, -1, __ATOMIC_RELEASE);
+    }
+}
+
+static void *durthread(_U_ void *arg){
+    long ms = policy == DUR_INTERVAL && interval < DUR_CHECKMS ? interval : DUR_CHECKMS;
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+    while(!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)){
+        nanosleep(&ts, NULL);
+        for(int i = 0; i < DUR_MAXFILES; ++i) check_file(&files[i]);
+    }
+    return NULL;
+}
+
+/**
+ * Start sync thread (if policy isn't "never")
+ */
+void durable_start(){
+    for(int i = 0; i < DUR_MAXFILES; ++i) files[i].fd = -1;
+    if(policy == DUR_NEVER) return;
+    // signals are handled by capture thread only (term_quit() joins this thread)
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&thread, NULL, durthread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err){
+        WARN(_("Can't run sync thread"));
+        return;
+    }
+    running = 1;
+}
+
+/**
+ * Add file to sync
+ * @param fd     - file descriptor
+ * @param offset - current size of file
+ * @return id of file or 0
+ */
+int durable_add(int fd, uint64_t offset){
+    if(!running) return 0;
+    int id = -1; // -1 - there's no free slots
+    pthread_mutex_lock(&addmutex);
+    for(int i = 0; i < DUR_MAXFILES; ++i){
+        durfile *f = &files[i];
+        if(__atomic_load_n(&f->fd, __ATOMIC_ACQUIRE) > -1) continue;
+        int dfd = dup(fd);
+        if(dfd < 0){
+            WARN(_("Can't sync file"));
+            id = 0;
+            break;
+        }
+        f->offset = f->synced = f->started = offset;
+        f->tsync = dtime();
+        f->closing = 0;
+        __atomic_store_n(&f->fd, dfd, __ATOMIC_RELEASE);
+        id = i + 1;
+        break;
+    }
+    pthread_mutex_unlock(&addmutex);
+    if(id < 0){
+        WARNX(_("Too much files to sync"));
+        id = 0;
+    }
+    return id;
+}
+
+/**
+ * Set amount of data written to file `id`
+ */
+void durable_setoff(int id, uint64_t offset){
+    if(id < 1) return;
+    __atomic_store_n(&files[id - 1].offset, offset, __ATOMIC_RELEASE);
+}
+
+/**
+ * File `id` is closed by owner: it would be synced & closed by thread
+ */
+void durable_del(int id){
+    if(id < 1) return;
+    __atomic_store_n(&files[id - 1].closing, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stop sync thread & sync all files
+ */
+void durable_stop(){
+    if(!running) return;
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    running = 0;
+    for(int i = 0; i < DUR_MAXFILES; ++i){
+        durfile *f = &files[i];
+        if(f->fd < 0) continue;
+        fdatasync(f->fd);
+        close(f->fd);
+        f->fd = -1;
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * durable.h - background syncing of logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __DURABLE_H__
+#define __DURABLE_H__
+
+#include <stdint.h>
+
+/*
+ * Logs are synced by background thread, so capture never waits for disk.
+ * Capture thread only stores offset of data written into file; sync thread
+ * works with its own dup() of descriptor, so file can be closed at any time
+ * (its last sync is done by thread). Files are identified by id > 0.
+ */
+
+// max amount of files
+#define DUR_MAXFILES    (1024)
+// period of checking files (ms) for modes other than "ms"
+#define DUR_CHECKMS     (10)
+// alignment of O_DIRECT writes
+#define DIRECT_ALIGN    (4096)
+
+int durable_setup(char *policy, int *direct);
+void durable_start();
+int durable_add(int fd, uint64_t offset);
+void durable_setoff(int id, uint64_t offset);
+void durable_del(int id);
+void durable_stop();
+
+#endif // __DURABLE_H__
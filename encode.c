@@ -0,0 +1,172 @@
+/*
+ * encode.c - encoding of binary data for human-facing outputs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "encode.h"
+#include "usefull_macros.h"
+
+// bytes per line of hexdump & max length of its line
+#define HEX_LINEBYTES   (16)
+#define HEX_LINELEN     (80)
+
+static const char *encnames[] = {"raw", "hex", "escape", "base64", NULL};
+
+// lookup tables (filled at first use)
+static char hexpair[256][2];            // "00" .. "FF"
+static char printable[256];             // character or '.'
+static struct{
+    char s[4];
+    uint8_t len;
+} escaped[256];                         // C-escaped bytes
+static char b64pair[4096][2];           // two base64 symbols of 12 bits
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static int tables_ready = 0;
+
+static void enc_init(){
+    static const char hex[] = "0123456789ABCDEF";
+    if(tables_ready) return;
+    for(int i = 0; i < 256; ++i){
+        hexpair[i][0] = hex[i >> 4];
+        hexpair[i][1] = hex[i & 0xf];
+        printable[i] = (i >= 0x20 && i < 0x7f) ? (char)i : '.';
+        char *s = escaped[i].s;
+        switch(i){
+            case '\n': memcpy(s, "\\n", 2); escaped[i].len = 2; break;
+            case '\r': memcpy(s, "\\r", 2); escaped[i].len = 2; break;
+            case '\t': memcpy(s, "\\t", 2); escaped[i].len = 2; break;
+            case '\\': memcpy(s, "\\\\", 2); escaped[i].len = 2; break;
+            default:
+                if(i >= 0x20 && i < 0x7f){
+                    s[0] = (char)i;
+                    escaped[i].len = 1;
+                }else{
+                    s[0] = '\\'; s[1] = 'x'; s[2] = hex[i >> 4]; s[3] = hex[i & 0xf];
+                    escaped[i].len = 4;
+                }
+        }
+    }
+    for(int i = 0; i < 4096; ++i){
+        b64pair[i][0] = b64[i >> 6];
+        b64pair[i][1] = b64[i & 0x3f];
+    }
+    tables_ready = 1;
+}
+
+/**
+ * Get encoding by name (raw, hex, escape or base64)
+ * @return encoding or -1 if name is wrong
+ */
+int enc_byname(const char *name){
+    for(int i = 0; encnames[i]; ++i)
+        if(strcasecmp(name, encnames[i]) == 0) return i;
+    return -1;
+}
+
+const char *enc_name(int enc){
+    if(enc < ENC_RAW || enc > ENC_BASE64) return NULL;
+    return encnames[enc];
+}
+
+/**
+ * @return max size of buffer for encoded data of `len` bytes
+ */
+size_t enc_maxlen(int enc, size_t len){
+    switch(enc){
+        case ENC_HEX:       return (len + HEX_LINEBYTES - 1) / HEX_LINEBYTES * HEX_LINELEN + 1;
+        case ENC_ESCAPE:    return 4 * len + 4; // each byte writes 4 symbols
+        case ENC_BASE64:    return (len + 2) / 3 * 4;
+        default:            return len;
+    }
+}
+
+// "0000  01 02 ... 10  |................|" lines
+static size_t enc_hex(char *out, const uint8_t *in, size_t len){
+    char *o = out;
+    int wide = len > 0x10000; // width of offsets: 4 or 8 digits
+    for(size_t off = 0; off < len; off += HEX_LINEBYTES){
+        size_t n = len - off < HEX_LINEBYTES ? len - off : HEX_LINEBYTES;
+        if(off) *o++ = '\n';
+        if(wide){
+            memcpy(o, hexpair[(off >> 24) & 0xff], 2); memcpy(o + 2, hexpair[(off >> 16) & 0xff], 2);
+            o += 4;
+        }
+        memcpy(o, hexpair[(off >> 8) & 0xff], 2); memcpy(o + 2, hexpair[off & 0xff], 2);
+        o[4] = ' ';
+        o += 5;
+        for(size_t i = 0; i < HEX_LINEBYTES; ++i){
+            o[0] = ' ';
+            if(i < n) memcpy(o + 1, hexpair[in[off + i]], 2);
+            else o[1] = o[2] = ' ';
+            o += 3;
+        }
+        o[0] = ' '; o[1] = ' '; o[2] = '|';
+        o += 3;
+        for(size_t i = 0; i < n; ++i) *o++ = printable[in[off + i]];
+        *o++ = '|';
+    }
+    return o - out;
+}
+
+static size_t enc_escape(char *out, const uint8_t *in, size_t len){
+    char *o = out;
+    for(size_t i = 0; i < len; ++i){
+        memcpy(o, escaped[in[i]].s, 4);
+        o += escaped[in[i]].len;
+    }
+    return o - out;
+}
+
+static size_t enc_base64(char *out, const uint8_t *in, size_t len){
+    char *o = out;
+    size_t i = 0;
+    for(; i + 3 <= len; i += 3){
+        uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i+1] << 8 | in[i+2];
+        memcpy(o, b64pair[v >> 12], 2);
+        memcpy(o + 2, b64pair[v & 0xfff], 2);
+        o += 4;
+    }
+    if(i < len){
+        uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < len ? (uint32_t)in[i+1] << 8 : 0);
+        memcpy(o, b64pair[v >> 12], 2);
+        o[2] = (i + 1 < len) ? b64[(v >> 6) & 0x3f] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+    return o - out;
+}
+
+/**
+ * Encode data
+ * @param enc - encoding
+ * @param out - output buffer (at least enc_maxlen(enc, len) bytes)
+ * @param in  - data
+ * @param len - its length
+ * @return length of encoded data
+ */
+size_t enc_encode(int enc, char *out, const char *in, size_t len){
+    enc_init();
+    switch(enc){
+        case ENC_HEX:       return enc_hex(out, (const uint8_t*)in, len);
+        case ENC_ESCAPE:    return enc_escape(out, (const uint8_t*)in, len);
+        case ENC_BASE64:    return enc_base64(out, (const uint8_t*)in, len);
+        default:
+            memcpy(out, in, len);
+            return len;
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * encode.h - encoding of binary data for human-facing outputs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __ENCODE_H__
+#define __ENCODE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * All encoders are table-driven: each input byte (or 12 bits in base64) is
+ * converted by one lookup. Output never ends with '\n'.
+ */
+
+typedef enum{
+    ENC_RAW = 0,    // data as is
+    ENC_HEX,        // hexdump with offsets & printable characters
+    ENC_ESCAPE,     // C-escaped string (\n, \t, \xHH ...)
+    ENC_BASE64      // base64
+} encoding;
+
+int enc_byname(const char *name);
+const char *enc_name(int enc);
+size_t enc_maxlen(int enc, size_t len);
+size_t enc_encode(int enc, char *out, const char *in, size_t len);
+
+#endif // __ENCODE_H__
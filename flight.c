@@ -0,0 +1,108 @@
+/*
+ * flight.c - RAM rings of records for flight recorder mode
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "flight.h"
+#include "usefull_macros.h"
+
+// full size of record in ring
+#define RECSZ(len)  ((sizeof(flrec) + (len) + 7) & ~(uint64_t)7)
+// length of wrap marker: rest of buffer is empty
+#define FLREC_WRAP  (UINT32_MAX)
+
+/**
+ * Create ring of `size` bytes (memory is allocated at once)
+ */
+flring *flring_new(size_t size){
+    flring *r = MALLOC(flring, 1);
+    r->size = (size + 7) & ~(size_t)7;
+    r->buf = MALLOC(char, r->size);
+    return r;
+}
+
+// bytes from position `pos` to the end of buffer
+static inline uint64_t torend(flring *r, uint64_t pos){
+    return r->size - pos % r->size;
+}
+
+// header of record at tail or NULL if it's end of buffer
+static flrec *tailrec(flring *r){
+    uint64_t rest = torend(r, r->tail);
+    if(rest < sizeof(flrec)) return NULL;
+    flrec *rec = (flrec*)(r->buf + r->tail % r->size);
+    if(rec->len == FLREC_WRAP) return NULL;
+    return rec;
+}
+
+// remove oldest record
+static void drop_oldest(flring *r){
+    flrec *rec = tailrec(r);
+    r->tail += rec ? RECSZ(rec->len) : torend(r, r->tail);
+}
+
+/**
+ * Put record into ring (oldest records are removed if there's no space)
+ * @param r     - ring
+ * @param t     - time of record
+ * @param data  - payload (would be truncated to half of ring)
+ * @param len   - its length
+ * @param addnl - '\n' should be added after payload
+ */
+void flring_put(flring *r, double t, const char *data, size_t len, int addnl){
+    if(RECSZ(len) > r->size / 2) len = r->size / 2 - sizeof(flrec);
+    uint64_t need = RECSZ(len), rest = torend(r, r->head);
+    if(rest < need){ // skip end of buffer
+        while(r->head + rest - r->tail > r->size) drop_oldest(r);
+        if(rest >= sizeof(flrec)) ((flrec*)(r->buf + r->head % r->size))->len = FLREC_WRAP;
+        r->head += rest;
+    }
+    while(r->head + need - r->tail > r->size) drop_oldest(r);
+    flrec *rec = (flrec*)(r->buf + r->head % r->size);
+    rec->t = t;
+    rec->len = (uint32_t)len;
+    rec->addnl = addnl;
+    memcpy(rec + 1, data, len);
+    r->head += need;
+}
+
+/**
+ * Get oldest record (payload is right after header)
+ * @return pointer to record or NULL if ring is empty
+ */
+flrec *flring_peek(flring *r){
+    while(r->tail < r->head){
+        flrec *rec = tailrec(r);
+        if(rec) return rec;
+        r->tail += torend(r, r->tail); // skip end of buffer
+    }
+    return NULL;
+}
+
+/**
+ * Remove oldest record (after flring_peek())
+ */
+void flring_next(flring *r){
+    if(r->tail < r->head) drop_oldest(r);
+}
+
+void flring_free(flring **r){
+    if(!r || !*r) return;
+    FREE((*r)->buf);
+    FREE(*r);
+}
@@ -0,0 +1,57 @@
+/*
+ * flight.h - RAM rings of records for flight recorder mode
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ring keeps last records of port: new record overwrites oldest ones.
+ * Each record lies in ring contiguously (end of buffer is skipped if record
+ * doesn't fit), so it can be read without copying.
+ */
+
+// default size of ring (MB) & time after trigger (s)
+#define FLIGHT_DEFSIZE  (4)
+#define FLIGHT_DEFPOST  (10)
+
+typedef struct{
+    double t;           // time of record
+    uint32_t len;       // payload length
+    uint32_t addnl;     // '\n' should be added after payload
+} flrec;
+
+typedef struct{
+    char *buf;          // data
+    uint64_t size;      // its size
+    uint64_t head;      // amount of bytes written
+    uint64_t tail;      // position of oldest record
+} flring;
+
+flring *flring_new(size_t size);
+void flring_put(flring *r, double t, const char *data, size_t len, int addnl);
+flrec *flring_peek(flring *r);
+void flring_next(flring *r);
+void flring_free(flring **r);
+
+#endif // __FLIGHT_H__
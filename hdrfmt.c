@@ -0,0 +1,161 @@
+/*
+ * hdrfmt.c - fast formatting of records' headers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <time.h>
+#include "hdrfmt.h"
+#include "usefull_macros.h"
+
+static const char *fmtnames[] = {"rel", "epoch", "iso", NULL};
+
+static int format = TIME_REL;
+// capture start: integer seconds & microseconds
+static int64_t t0sec = 0, t0us = 0;
+// cached integer part of absolute time (with trailing '.')
+static int64_t cachedsec = -1;
+static char prefix[HDR_TIMELEN];
+static size_t prefixlen = 0;
+
+// "00" .. "99"
+static const char digits2[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// write unsigned integer, return its length
+static size_t put_uint(char *out, uint64_t v){
+    char tmp[24], *p = tmp + sizeof(tmp);
+    while(v >= 100){
+        p -= 2;
+        memcpy(p, digits2 + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if(v >= 10){
+        p -= 2;
+        memcpy(p, digits2 + v * 2, 2);
+    }else *--p = (char)('0' + v);
+    size_t L = tmp + sizeof(tmp) - p;
+    memcpy(out, p, L);
+    return L;
+}
+
+// write 6 digits of microseconds
+static inline void put_us(char *out, uint32_t us){
+    memcpy(out, digits2 + (us / 10000) * 2, 2);
+    memcpy(out + 2, digits2 + (us / 100 % 100) * 2, 2);
+    memcpy(out + 4, digits2 + (us % 100) * 2, 2);
+}
+
+/**
+ * Get time format by name (rel, epoch or iso)
+ * @return format or -1 if name is wrong
+ */
+int hdr_byname(const char *name){
+    for(int i = 0; fmtnames[i]; ++i)
+        if(strcasecmp(name, fmtnames[i]) == 0) return i;
+    return -1;
+}
+
+/**
+ * Set format of time & capture start
+ */
+void hdr_setup(int fmt, double t0){
+    format = fmt;
+    t0sec = (int64_t)t0;
+    t0us = (int64_t)((t0 - t0sec) * 1e6 + 0.5);
+    cachedsec = -1;
+}
+
+/**
+ * @return 1 if headers contain absolute time
+ */
+int hdr_absolute(){
+    return format != TIME_REL;
+}
+
+/**
+ * Convert time from capture start into time of headers
+ */
+double hdr_abstime(double t){
+    if(format == TIME_REL) return t;
+    return (double)t0sec + (t0us + t * 1e6) / 1e6;
+}
+
+/**
+ * Write time of record (without trailing zero)
+ * @param out - buffer (at least HDR_TIMELEN bytes)
+ * @param t   - time from capture start
+ * @return length of string
+ */
+size_t hdr_time(char *out, double t){
+    if(t < 0.) t = 0.;
+    int64_t us = (int64_t)(t * 1e6 + 0.5);
+    if(format == TIME_REL){
+        size_t L = put_uint(out, (uint64_t)(us / 1000000));
+        out[L] = '.';
+        put_us(out + L + 1, (uint32_t)(us % 1000000));
+        return L + 7;
+    }
+    us += t0us;
+    int64_t sec = t0sec + us / 1000000;
+    if(sec != cachedsec){ // new second: format integer part
+        if(format == TIME_EPOCH) prefixlen = put_uint(prefix, (uint64_t)sec);
+        else{
+            time_t tt = (time_t)sec;
+            struct tm tm;
+            gmtime_r(&tt, &tm);
+            prefixlen = strftime(prefix, HDR_TIMELEN, "%Y-%m-%dT%H:%M:%S", &tm);
+        }
+        prefix[prefixlen++] = '.';
+        cachedsec = sec;
+    }
+    memcpy(out, prefix, prefixlen);
+    put_us(out + prefixlen, (uint32_t)(us % 1000000));
+    size_t L = prefixlen + 6;
+    if(format == TIME_ISO) out[L++] = 'Z';
+    return L;
+}
+
+/**
+ * Header of per-port log: "time\n" ("time~\n" if '\n' after payload is added)
+ * @param out   - buffer (at least HDR_TIMELEN + 2 bytes)
+ * @param addnl - '\n' after payload isn't a part of data
+ */
+size_t hdr_port(char *out, double t, int addnl){
+    size_t L = hdr_time(out, t);
+    if(addnl) out[L++] = HDR_ADDNL;
+    out[L++] = '\n';
+    return L;
+}
+
+/**
+ * Header of common log & stdout: "time: port\n" ("time~: port\n" if '\n' after payload is added)
+ * @param out   - buffer (at least HDR_TIMELEN + portlen + 4 bytes)
+ * @param addnl - '\n' after payload isn't a part of data
+ */
+size_t hdr_common(char *out, double t, const char *port, size_t portlen, int addnl){
+    size_t L = hdr_time(out, t);
+    if(addnl) out[L++] = HDR_ADDNL;
+    out[L++] = ':';
+    out[L++] = ' ';
+    memcpy(out + L, port, portlen);
+    L += portlen;
+    out[L++] = '\n';
+    return L;
+}
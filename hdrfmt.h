@@ -0,0 +1,54 @@
+/*
+ * hdrfmt.h - fast formatting of records' headers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __HDRFMT_H__
+#define __HDRFMT_H__
+
+#include <stddef.h>
+
+/*
+ * Time of record is printed in fixed point with microseconds:
+ *      relative: "123.456789" (seconds from capture start)
+ *      epoch:    "1760860321.123456" (UNIX time)
+ *      iso:      "2026-10-19T08:32:01.123456Z" (UTC)
+ * Integer part of absolute time is cached, so it's formatted once per second.
+ */
+
+typedef enum{
+    TIME_REL = 0,
+    TIME_EPOCH,
+    TIME_ISO
+} timeformat;
+
+// max length of time string
+#define HDR_TIMELEN     (32)
+// mark after time: '\n' after payload was added by multiterm (not received)
+#define HDR_ADDNL       '~'
+
+int hdr_byname(const char *name);
+void hdr_setup(int format, double t0);
+int hdr_absolute();
+double hdr_abstime(double t);
+size_t hdr_time(char *out, double t);
+size_t hdr_port(char *out, double t, int addnl);
+size_t hdr_common(char *out, double t, const char *port, size_t portlen, int addnl);
+
+#endif // __HDRFMT_H__
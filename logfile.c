@@ -0,0 +1,271 @@
+/*
+ * logfile.c - parsing of log files & their sparse time index
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#include <time.h>
+#include "hdrfmt.h"
+#include "logfile.h"
+
+/**
+ * Parse time of record header: number or ISO-8601 UTC time ("2026-10-19T08:32:01.123456Z")
+ * @param s   - header
+ * @param eol - its end
+ * @param ep (o) - end of time string (`s` if it isn't a time)
+ * @return time value
+ */
+static double parse_time(const char *s, const char *eol, const char **ep){
+    if(eol - s > 19 && s[4] == '-' && s[10] == 'T'){
+        struct tm tm = {0};
+        const char *e = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+        if(!e || e > eol){
+            *ep = s;
+            return 0.;
+        }
+        double frac = 0.;
+        if(*e == '.'){
+            char *fe;
+            frac = strtod(e, &fe);
+            e = fe;
+        }
+        if(*e == 'Z') ++e;
+        *ep = e;
+        return (double)timegm(&tm) + frac;
+    }
+    char *e;
+    double t = strtod(s, &e);
+    *ep = e;
+    return t;
+}
+
+/**
+ * Parse record of log file
+ * @param b   - mmaped log file
+ * @param off - offset of record header
+ * @param r (o) - parsed record
+ * @return 1 if all OK, 0 at the end of file or if data at `off` isn't a record
+ */
+int log_getrec(mmapbuf *b, size_t off, logrec *r){
+    if(!b || !r || off >= b->len) return 0;
+    const char *start = b->data + off, *end = b->data + b->len;
+    const char *eol = memchr(start, '\n', end - start);
+    if(!eol) return 0;
+    const char *ep;
+    double t = parse_time(start, eol, &ep);
+    if(ep == start || ep > eol) return 0;
+    r->addnl = (ep < eol && *ep == HDR_ADDNL);
+    if(r->addnl) ++ep;
+    r->port = NULL; r->portlen = 0;
+    if(ep != eol){ // common log: "time: port"
+        if(eol - ep < 2 || ep[0] != ':' || ep[1] != ' ') return 0;
+        r->port = ep + 2;
+        r->portlen = eol - r->port;
+    }
+    const char *data = eol + 1;
+    if(data >= end) return 0;
+    const char *dend = memchr(data, '\n', end - data);
+    if(!dend) return 0; // record isn't full yet
+    r->t = t;
+    r->hdr = start;
+    r->data = data;
+    r->len = dend - data;
+    r->next = dend + 1 - b->data;
+    return 1;
+}
+
+/**
+ * Create index file for given log
+ * @param logname - name of log file
+ * @param t0      - time of capture start
+ * @param step    - amount of records between index entries
+ * @param flags   - IDX_ABSTIME if log have absolute times
+ * @return fd of opened index or -1 in case of error
+ */
+int logidx_create(const char *logname, double t0, uint32_t step, uint32_t flags){
+    char idxname[PATH_MAX];
+    snprintf(idxname, PATH_MAX, "%s" IDX_SUFFIX, logname);
+    int fd = open(idxname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0){
+        WARN("open(%s) failed", idxname);
+        return -1;
+    }
+    logidx_hdr hdr = {.magick = IDX_MAGICK, .step = step, .flags = flags, .t0 = t0};
+    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)){
+        WARN("write(%s) failed", idxname);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Open existing index of given log for appending (when log is reopened)
+ * @param logname - name of log file
+ * @return fd of opened index or -1 if there's no index
+ */
+int logidx_append(const char *logname){
+    char idxname[PATH_MAX];
+    snprintf(idxname, PATH_MAX, "%s" IDX_SUFFIX, logname);
+    return open(idxname, O_WRONLY | O_APPEND);
+}
+
+/**
+ * Add entry into index file
+ * @param fd     - index file descriptor
+ * @param t      - time of record
+ * @param offset - offset of record header in log
+ */
+void logidx_add(int fd, double t, uint64_t offset){
+    logidx_entry e = {.t = t, .offset = offset};
+    if(write(fd, &e, sizeof(e)) != sizeof(e)) DBG("can't write index entry");
+}
+
+/**
+ * Try to read index file & check its consistency with log
+ * @return index read or NULL
+ */
+static logidx *read_idx(const char *idxname, mmapbuf *log){
+    int fd = open(idxname, O_RDONLY);
+    if(fd < 0) return NULL;
+    logidx *idx = NULL;
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(logidx_hdr)) goto ret;
+    size_t N = (st.st_size - sizeof(logidx_hdr)) / sizeof(logidx_entry);
+    idx = MALLOC(logidx, 1);
+    idx->entries = MALLOC(logidx_entry, N + 1);
+    if(read(fd, &idx->hdr, sizeof(logidx_hdr)) != sizeof(logidx_hdr) ||
+        strncmp(idx->hdr.magick, IDX_MAGICK, sizeof(idx->hdr.magick)) || !idx->hdr.step) goto bad;
+    ssize_t L = N * sizeof(logidx_entry);
+    if(read(fd, idx->entries, L) != L) goto bad;
+    idx->N = N;
+    // check that offsets are growing & point to records
+    uint64_t prev = 0;
+    for(size_t i = 0; i < N; ++i){
+        logrec r;
+        if(i && idx->entries[i].offset <= prev) goto bad;
+        prev = idx->entries[i].offset;
+        if(i == N - 1 && !log_getrec(log, prev, &r)) goto bad;
+    }
+    goto ret;
+bad:
+    WARNX(_("Index %s is broken"), idxname);
+    logidx_free(&idx);
+ret:
+    close(fd);
+    return idx;
+}
+
+/**
+ * Scan log file & build its index
+ */
+static logidx *build_idx(mmapbuf *log, uint32_t step){
+    size_t sz = 1024, off = 0, nrec = 0;
+    logidx *idx = MALLOC(logidx, 1);
+    memcpy(idx->hdr.magick, IDX_MAGICK, sizeof(idx->hdr.magick));
+    idx->hdr.step = step;
+    idx->entries = MALLOC(logidx_entry, sz);
+    logrec r;
+    while(log_getrec(log, off, &r)){
+        if(nrec++ % step == 0){
+            if(idx->N == sz){
+                sz *= 2;
+                idx->entries = realloc(idx->entries, sz * sizeof(logidx_entry));
+                if(!idx->entries) ERR("realloc");
+            }
+            idx->entries[idx->N].t = r.t;
+            idx->entries[idx->N++].offset = off;
+        }
+        off = r.next;
+    }
+    if(off < log->len) WARNX(_("Can't parse data after offset %zd"), off);
+    if(idx->N && idx->entries[0].t > IDX_ABSMIN){ // absolute times: capture started near first record
+        idx->hdr.flags |= IDX_ABSTIME;
+        idx->hdr.t0 = idx->entries[0].t;
+    }
+    return idx;
+}
+
+/**
+ * Load index of log file or build it if absent (and try to save)
+ * @param logname - name of log file
+ * @param log     - mmaped log
+ * @param step    - amount of records between index entries (if index should be built)
+ * @return index (should be freed by logidx_free)
+ */
+logidx *logidx_load(const char *logname, mmapbuf *log, uint32_t step){
+    char idxname[PATH_MAX];
+    snprintf(idxname, PATH_MAX, "%s" IDX_SUFFIX, logname);
+    logidx *idx = read_idx(idxname, log);
+    if(idx){
+        DBG("Index %s loaded: %zd entries", idxname, idx->N);
+        return idx;
+    }
+    if(!step) step = IDX_DEFSTEP;
+    idx = build_idx(log, step);
+    DBG("Index for %s built: %zd entries", logname, idx->N);
+    int fd = open(idxname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0){
+        WARN(_("Can't save index %s"), idxname);
+        return idx;
+    }
+    ssize_t L = idx->N * sizeof(logidx_entry);
+    logidx_hdr hdr = idx->hdr; // gcc -O2 takes &idx->hdr as pointer to its first field
+    if(write(fd, &hdr, sizeof(logidx_hdr)) != sizeof(logidx_hdr) ||
+        write(fd, idx->entries, L) != L) WARN(_("Can't save index %s"), idxname);
+    close(fd);
+    return idx;
+}
+
+/**
+ * Find offset in log to start searching of time `t` (binary search)
+ * @return offset of last indexed record with time less than `t`
+ */
+size_t logidx_find(logidx *idx, double t){
+    if(!idx || !idx->N || idx->entries[0].t >= t) return 0;
+    size_t l = 0, r = idx->N; // entries[l].t < t, entries[r].t >= t
+    while(r - l > 1){
+        size_t m = (l + r) / 2;
+        if(idx->entries[m].t < t) l = m;
+        else r = m;
+    }
+    return idx->entries[l].offset;
+}
+
+/**
+ * Find offset in log where records after time `t` begin (binary search)
+ * @param len - log length
+ * @return offset of first indexed record with time greater than `t` or `len`
+ */
+size_t logidx_after(logidx *idx, double t, size_t len){
+    if(!idx || !idx->N || idx->entries[idx->N - 1].t <= t) return len;
+    size_t l = 0, r = idx->N - 1; // entries[r].t > t
+    if(idx->entries[0].t > t) return idx->entries[0].offset;
+    while(r - l > 1){ // entries[l].t <= t
+        size_t m = (l + r) / 2;
+        if(idx->entries[m].t > t) r = m;
+        else l = m;
+    }
+    return idx->entries[r].offset;
+}
+
+void logidx_free(logidx **idx){
+    if(!idx || !*idx) return;
+    FREE((*idx)->entries);
+    FREE(*idx);
+}
@@ -0,0 +1,88 @@
+/*
+ * logfile.h - format of log files & their sparse time index
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __LOGFILE_H__
+#define __LOGFILE_H__
+
+#include <stdint.h>
+#include <limits.h>         // PATH_MAX
+#include "usefull_macros.h"
+
+/*
+ * Each record of log file consists of two lines:
+ *      header ("time\n" in port logs or "time: port\n" in common log; time is
+ *          seconds from capture start, UNIX time or ISO-8601 UTC time)
+ *      payload (without any '\n' inside) terminated by '\n'
+ * Index file "logname.idx" contains header and entry per each `step` records
+ */
+
+// suffix of index file
+#define IDX_SUFFIX      ".idx"
+// index file magick
+#define IDX_MAGICK      "MTIDX01"
+// default amount of records between index entries
+#define IDX_DEFSTEP     (256)
+// flags of index: times in log & index are UNIX times (not from capture start)
+#define IDX_ABSTIME     (1)
+// logs with times greater than this are treated as absolute when index is built
+#define IDX_ABSMIN      (1e9)
+
+typedef struct{
+    char magick[8];     // IDX_MAGICK
+    uint32_t step;      // records per index entry
+    uint32_t flags;     // IDX_ABSTIME
+    double t0;          // UNIX time of capture start (0 if unknown)
+} logidx_hdr;
+
+typedef struct{
+    double t;           // time of record
+    uint64_t offset;    // offset of record header in log file
+} logidx_entry;
+
+typedef struct{
+    logidx_hdr hdr;         // index header
+    logidx_entry *entries;  // index entries
+    size_t N;               // their amount
+} logidx;
+
+// single record of log file
+typedef struct{
+    double t;           // record time from header
+    const char *hdr;    // header start
+    const char *port;   // port name (in common log) or NULL
+    size_t portlen;     // length of port name
+    const char *data;   // payload
+    size_t len;         // its length (without trailing '\n')
+    int addnl;          // trailing '\n' was added by multiterm (not a part of data)
+    size_t next;        // offset of next record
+} logrec;
+
+int log_getrec(mmapbuf *b, size_t off, logrec *r);
+
+int logidx_create(const char *logname, double t0, uint32_t step, uint32_t flags);
+int logidx_append(const char *logname);
+void logidx_add(int fd, double t, uint64_t offset);
+logidx *logidx_load(const char *logname, mmapbuf *log, uint32_t step);
+size_t logidx_find(logidx *idx, double t);
+size_t logidx_after(logidx *idx, double t, size_t len);
+void logidx_free(logidx **idx);
+
+#endif // __LOGFILE_H__
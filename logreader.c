@@ -0,0 +1,282 @@
+/*
+ * logreader.c - fast reader of multiterm logs: seek to time range by index
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <float.h>          // DBL_MAX
+#include <inttypes.h>       // PRIu64
+#include <signal.h>
+#include <time.h>
+#include "colfile.h"
+#include "logfile.h"
+#include "parseargs.h"
+#include "query.h"
+#include "replay.h"
+#include "shmtap.h"
+#include "timing.h"
+#include "usefull_macros.h"
+
+// output buffer size
+#define OUTBUFSZ    (1<<20)
+
+static int help = 0, rawout = 0, idxstep = IDX_DEFSTEP, nthreads = 0, timing = 0, columnar = 0;
+static char *tstart = NULL, *tend = NULL, *outfile = NULL, *hexpattern = NULL, *shmname = NULL;
+static char **replayto = NULL;
+static double speed = 1.;
+static logfilter filter = {0};
+
+static myoption cmdlnopts[] = {
+    {"help",    NO_ARGS,    NULL,   'h',    arg_int,    APTR(&help),        _("show this help")},
+    {"start",   NEED_ARG,   NULL,   's',    arg_string, APTR(&tstart),      _("start of time range (seconds from capture start or HH:MM[:SS])")},
+    {"end",     NEED_ARG,   NULL,   'e',    arg_string, APTR(&tend),        _("end of time range (seconds from capture start or HH:MM[:SS])")},
+    {"raw",     NO_ARGS,    NULL,   'r',    arg_none,   APTR(&rawout),      _("output only payload (without headers)")},
+    {"output",  NEED_ARG,   NULL,   'o',    arg_string, APTR(&outfile),     _("export data into given file instead of stdout")},
+    {"index-step",NEED_ARG, NULL,   'I',    arg_int,    APTR(&idxstep),     _("amount of records between entries of index built")},
+    {"threads", NEED_ARG,   NULL,   'j',    arg_int,    APTR(&nthreads),    _("amount of search threads (default: amount of CPUs)")},
+    {"port",    MULT_PAR,   NULL,   'p',    arg_string, APTR(&filter.ports),_("select records of given port")},
+    {"grep",    NEED_ARG,   NULL,   'g',    arg_string, APTR(&filter.literal),_("select records with given substring")},
+    {"regex",   NEED_ARG,   NULL,   'E',    arg_string, APTR(&filter.regex),_("select records matching extended regular expression")},
+    {"hex",     NEED_ARG,   NULL,   'x',    arg_string, APTR(&hexpattern),  _("select records with given bytes (like \"de ad be ef\")")},
+    {"shm",     NEED_ARG,   NULL,   'S',    arg_string, APTR(&shmname),     _("read live records from shared memory ring of multiterm")},
+    {"timing",  NO_ARGS,    NULL,   'T',    arg_none,   APTR(&timing),      _("files are timing files: print chunks (only histogram of gaps with -r)")},
+    {"replay",  MULT_PAR,   NULL,   'R',    arg_string, APTR(&replayto),    _("replay records keeping their timing into \"[port=]dest\" (dest is \"pty\" or device)")},
+    {"speed",   NEED_ARG,   NULL,   'v',    arg_double, APTR(&speed),       _("speed factor of replay (0 - as fast as possible, default: 1)")},
+    {"columnar",NO_ARGS,    NULL,   'C',    arg_none,   APTR(&columnar),    _("export records into columnar file given by --output")},
+    end_option
+};
+
+static volatile int stop = 0;
+
+void signals(int sig){
+    exit(sig);
+}
+
+static void onstop(_U_ int sig){
+    stop = 1;
+}
+
+/**
+ * Print records from shared memory ring until multiterm closes it or user press ctrl+C
+ * @param name - name of ring
+ * @param out  - output stream
+ * @return 0 if all OK
+ */
+static int readshm(char *name, FILE *out){
+    shmtap *s = shmtap_attach(name);
+    if(!s) return 1;
+    signal(SIGINT, onstop);
+    signal(SIGTERM, onstop);
+    shmtap_rec r;
+    char *buf = MALLOC(char, s->hdr->size);
+    uint64_t gaps = 0;
+    while(!stop){
+        if(!shmtap_get(s, &r, buf, s->hdr->size)){
+            if(__atomic_load_n(&s->hdr->closed, __ATOMIC_ACQUIRE)) break;
+            fflush(out);
+            usleep(1000);
+            continue;
+        }
+        if(gaps != s->gaps){
+            fprintf(out, "# lost %" PRIu64 " bytes (%" PRIu64 " overruns)\n", s->lost, s->gaps);
+            gaps = s->gaps;
+        }
+        const char *port = r.port < SHMTAP_MAXPORTS ? s->hdr->ports[r.port] : "?";
+        if(!portmatch(port, strlen(port), filter.ports)) continue;
+        if(!rawout) fprintf(out, "%g: %s\n", r.t, port);
+        fwrite(buf, 1, r.len, out);
+        if(!r.len || buf[r.len - 1] != '\n') fputc('\n', out);
+    }
+    fflush(out);
+    if(s->gaps) WARNX(_("Overruns: %" PRIu64 ", bytes lost: %" PRIu64), s->gaps, s->lost);
+    FREE(buf);
+    shmtap_detach(&s);
+    return 0;
+}
+
+/**
+ * Convert time specification into time of log records
+ * @param str - "123.4" (seconds from capture start) or "HH:MM[:SS[.s]]" (local time)
+ * @param t0  - UNIX time of capture start
+ * @param t (o) - time value
+ * @return FALSE if `str` is wrong
+ */
+static int str2logtime(const char *str, double t0, double *t){
+    if(!strchr(str, ':')) return str2double(t, str);
+    int h, m;
+    double s = 0.;
+    if(sscanf(str, "%d:%d:%lf", &h, &m, &s) < 2 || h < 0 || h > 23 || m < 0 || m > 59 || s < 0. || s >= 61.){
+        WARNX(_("Wrong time format: %s"), str);
+        return FALSE;
+    }
+    if(t0 < 1.){
+        WARNX(_("Log has no start time in index, can't use absolute time %s"), str);
+        return FALSE;
+    }
+    time_t start = (time_t) t0;
+    struct tm tm;
+    localtime_r(&start, &tm);
+    tm.tm_hour = h; tm.tm_min = m; tm.tm_sec = 0;
+    double tabs = (double)mktime(&tm) + s;
+    if(tabs < t0 - 43200.) tabs += 86400.; // next day after capture start
+    *t = tabs - t0;
+    return TRUE;
+}
+
+/**
+ * Print chunks of timing file in given time range & histogram of idle gaps
+ * @param name - file name
+ * @param out  - output stream
+ * @return 0 if all OK
+ */
+static int readtiming(char *name, FILE *out){
+    mmapbuf *b = My_mmap(name);
+    if(!b) return 1;
+    const timhdr *hdr = (const timhdr*)b->data;
+    if(b->len < sizeof(timhdr) || strncmp(hdr->magick, TIM_MAGICK, sizeof(hdr->magick))){
+        WARNX(_("%s isn't a timing file"), name);
+        My_munmap(b);
+        return 1;
+    }
+    double ts = -1., te = DBL_MAX;
+    if((tstart && !str2logtime(tstart, hdr->t0, &ts)) || (tend && !str2logtime(tend, hdr->t0, &te))){
+        My_munmap(b);
+        return 1;
+    }
+    timhist h = {0};
+    uint64_t us = 0, dt;
+    uint32_t nbytes;
+    int resync = 0;
+    size_t off = sizeof(timhdr), n;
+    while(off < b->len && (n = tim_decode(b->data + off, b->len - off, &dt, &nbytes))){
+        int first = (off == sizeof(timhdr)) || resync; // delta of first entry is from capture start or resync
+        off += n;
+        if((resync = !nbytes)){ // absolute time after appending
+            us = dt;
+            continue;
+        }
+        us += dt;
+        double t = us / 1e6;
+        if(t < ts) continue;
+        if(t > te) break;
+        if(!first) tim_histadd(&h, dt, nbytes, hdr->charns);
+        if(!rawout) fprintf(out, "%.6f: %u\n", t, nbytes);
+    }
+    if(off < b->len && us / 1e6 <= te) WARNX(_("%s: broken entry at offset %zd"), name, off);
+    fprintf(out, "# %s: idle gaps between chunks (character time %uns)\n", name, hdr->charns);
+    tim_histprint(&h, out);
+    My_munmap(b);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    initial_setup();
+    change_helpstring("Usage: %s [args] logfiles\n\n\tWhere args are:\n");
+    parseargs(&argc, &argv, cmdlnopts);
+    if(help || (argc < 1 && !shmname)) showhelp(-1, cmdlnopts);
+    if(idxstep < 1) ERRX(_("Wrong index step: %d"), idxstep);
+    if(hexpattern && !(filter.bytes = hex2bytes(hexpattern, &filter.nbytes)))
+        ERRX(_("Wrong byte pattern: %s"), hexpattern);
+    if(shmname){
+        FILE *out = stdout;
+        if(outfile && !(out = fopen(outfile, "w"))) ERR(_("Can't open %s"), outfile);
+        int ret = readshm(shmname, out);
+        fclose(out);
+        return ret;
+    }
+    if(timing){
+        FILE *out = stdout;
+        if(outfile && !(out = fopen(outfile, "w"))) ERR(_("Can't open %s"), outfile);
+        int ret = 0;
+        for(int i = 0; i < argc; ++i) ret |= readtiming(argv[i], out);
+        if(fclose(out)) ERR(_("Can't write output"));
+        return ret;
+    }
+    if((columnar || (argc > 0 && col_check(argv[0]))) && (filter.literal || filter.regex || filter.bytes))
+        ERRX(_("Only time range & ports can be selected in columnar files"));
+    if(argc > 0 && col_check(argv[0])){
+        if(columnar) ERRX(_("%s is a columnar file already"), argv[0]);
+        FILE *out = stdout;
+        if(outfile && !(out = fopen(outfile, "w"))) ERR(_("Can't open %s"), outfile);
+        setvbuf(out, NULL, _IOFBF, OUTBUFSZ);
+        int ret = 0;
+        for(int i = 0; i < argc; ++i){
+            colfile *c = col_open(argv[i]);
+            if(!c){ ret = 1; continue; }
+            double ts = -DBL_MAX, te = DBL_MAX;
+            if((tstart && !str2logtime(tstart, c->hdr->t0, &ts)) || (tend && !str2logtime(tend, c->hdr->t0, &te)))
+                ret = 1;
+            else{
+                if(c->hdr->flags & IDX_ABSTIME){
+                    if(tstart) ts += c->hdr->t0;
+                    if(tend) te += c->hdr->t0;
+                }
+                if(col_print(c, ts, te, filter.ports, out, rawout) < 0) ret = 1;
+            }
+            col_close(&c);
+        }
+        if(fclose(out)) ERR(_("Can't write output"));
+        return ret;
+    }
+    if(columnar && !outfile) ERRX(_("Columnar export needs --output"));
+    if(nthreads < 1) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    // open all logs & convert time range for each of them
+    logsrc **src = MALLOC(logsrc*, argc);
+    int nsrc = 0, ret = 0;
+    for(int i = 0; i < argc; ++i){
+        logsrc *s = logsrc_open(argv[i], (uint32_t)idxstep);
+        if(!s){ ret = 1; continue; }
+        if((tstart && !str2logtime(tstart, s->idx->hdr.t0, &s->ts)) ||
+            (tend && !str2logtime(tend, s->idx->hdr.t0, &s->te))){
+            logsrc_close(&s);
+            ret = 1;
+            continue;
+        }
+        if(s->idx->hdr.flags & IDX_ABSTIME){ // log have UNIX times
+            if(tstart) s->ts += s->idx->hdr.t0;
+            if(tend) s->te += s->idx->hdr.t0;
+        }
+        DBG("%s: from %g to %g", s->name, s->ts, s->te);
+        src[nsrc++] = s;
+    }
+    if(!nsrc) ERRX(_("No logs to read"));
+    if(replayto){
+        long long N = replay_run(src, nsrc, &filter, replayto, speed, rawout);
+        if(N < 0) ret = 1;
+        for(int i = 0; i < nsrc; ++i) logsrc_close(&src[i]);
+        FREE(src);
+        return ret;
+    }
+    if(columnar){
+        long long N = col_export(src, nsrc, filter.ports, nthreads, outfile);
+        if(N < 0) ret = 1;
+        else green(_("Exported %lld records\n"), N);
+        for(int i = 0; i < nsrc; ++i) logsrc_close(&src[i]);
+        FREE(src);
+        return ret;
+    }
+    FILE *out = stdout;
+    if(outfile && !(out = fopen(outfile, "w"))) ERR(_("Can't open %s"), outfile);
+    setvbuf(out, NULL, _IOFBF, OUTBUFSZ);
+    long long N = query_run(src, nsrc, &filter, nthreads, out, rawout);
+    if(N < 0) ret = 1;
+    DBG("Found %lld records", N);
+    if(fclose(out)) ERR(_("Can't write output"));
+    for(int i = 0; i < nsrc; ++i) logsrc_close(&src[i]);
+    FREE(src);
+    return ret;
+}
@@ -19,6 +19,14 @@
  * MA 02110-1301, USA.
  */
 #include <signal.h>
+#include "config.h"
+#include "decode.h"
+#include "encode.h"
+#include "durable.h"
+#include "flight.h"
+#include "hdrfmt.h"
+#include "rtsched.h"
+#include "supervisor.h"
 #include "term.h"
 #include "usefull_macros.h"
 #include "cmdlnopts.h"
@@ -31,6 +39,129 @@ void signals(int sig){
 }
 
 
+static glob_pars *Glob = NULL;
+// max latency of outputs (ms) for ports given in command line
+static int flushlatency = 0;
+// encoding of ports' data in stdout & socket outputs
+static int portenc = ENC_RAW;
+// rate limit of ports' records
+static ratelimit portlimit = {0};
+// format of time in headers
+static int timefmt = TIME_REL;
+// supervisor mode: shard of ports captured by this worker process
+static int shard = -1;
+
+/**
+ * Parse flush policy: "exact" or "latency=ms,bytes=N"
+ */
+static void set_flush(char *policy){
+    int exact = 0, bytes = FLUSH_DEFBYTES;
+    mysuboption flushopts[] = {
+        {"exact",   NO_ARGS,    arg_none,   &exact},
+        {"latency", NEED_ARG,   arg_int,    &flushlatency},
+        {"bytes",   NEED_ARG,   arg_int,    &bytes},
+        end_suboption
+    };
+    if(!get_suboption(policy, flushopts) || flushlatency < 0)
+        ERRX(_("Wrong flush policy: %s"), policy);
+    if(exact) flushlatency = 0;
+    set_flushbytes(bytes);
+}
+
+/**
+ * Get settings of ports from command line & configuration file
+ * (called at start & on reload)
+ * @param nports (o) - amount of ports
+ * @return array of settings or NULL in case of error
+ */
+static portcfg *get_ports(int *nports){
+    portcfg defcfg = {.speed = Glob->glob_spd, .framing = "8N1", .charmode = Glob->charmode, .bufsize = LOGBUFSZ,
+        .latency = flushlatency, .timing = Glob->timing, .decoder = Glob->decoder, .encoding = portenc,
+        .dedup = Glob->dedup, .limit = portlimit};
+    portcfg *ports = NULL;
+    int N = 0;
+    if(Glob->ports){
+        for(char **p = Glob->ports; *p; ++p) ++N;
+        ports = MALLOC(portcfg, N);
+        for(int i = 0; i < N; ++i){
+            ports[i] = defcfg;
+            ports[i].name = strdup(Glob->ports[i]);
+            ports[i].framing = strdup(defcfg.framing);
+            if(defcfg.decoder) ports[i].decoder = strdup(defcfg.decoder);
+            if(Glob->speeds) ports[i].speed = *Glob->speeds[i];
+        }
+    }
+    if(Glob->config)
+        ports = read_config(Glob->config, &defcfg, ports, &N);
+    *nports = N;
+    return ports;
+}
+
+// number of worker capturing given port in supervisor mode
+static int port_shard(const char *name){
+    uint32_t h = 5381;
+    while(*name) h = h * 33 + (uint8_t)*name++;
+    return (int)(h % (uint32_t)Glob->workers);
+}
+
+/**
+ * Get settings of ports of worker's shard (shard of port depends only on its
+ * name, so ports don't move between workers on reload)
+ */
+static portcfg *shard_ports(int *nports){
+    int N = 0, n = 0;
+    portcfg *ports = get_ports(&N);
+    if(!ports) return NULL;
+    for(int i = 0; i < N; ++i){
+        if(port_shard(ports[i].name) == shard) ports[n++] = ports[i];
+        else portcfg_clear(&ports[i]);
+    }
+    *nports = n;
+    return ports;
+}
+
+/**
+ * Start capture in worker process of supervisor mode: worker captures its
+ * shard of ports & publishes records into shared memory ring for supervisor
+ * @param n         - number of shard
+ * @param ring      - name of ring
+ * @param t0        - time of capture start
+ * @param restarted - worker was restarted after crash
+ */
+static void start_worker(int n, const char *ring, double t0, int restarted){
+    signal(SIGHUP,  term_reload);
+    signal(SIGTERM, signals);
+    signal(SIGINT,  signals);
+    signal(SIGQUIT, signals);
+    signal(SIGUSR2, term_trigger);
+    setbuf(stdout, NULL);
+    shard = n;
+    set_starttime(t0, restarted); // continue logs written before crash
+    set_stdqueue(0); // supervisor writes records to stdout & common log
+    set_shmname((char*)ring, Glob->shmsize);
+    set_portsgetter(shard_ports);
+    int nports;
+    portcfg *ports = shard_ports(&nports);
+    if(!ports) ERRX(_("Can't get ports' settings"));
+    ttys_open(ports, nports);
+}
+
+/**
+ * Parse flight recorder settings: "mb=N,s=N,post=N"
+ */
+static void set_flightmode(char *str){
+    int mb = FLIGHT_DEFSIZE, keep = 0, post = FLIGHT_DEFPOST;
+    mysuboption flightopts[] = {
+        {"mb",      NEED_ARG,   arg_int,    &mb},
+        {"s",       NEED_ARG,   arg_int,    &keep},
+        {"post",    NEED_ARG,   arg_int,    &post},
+        end_suboption
+    };
+    if(!get_suboption(str, flightopts))
+        ERRX(_("Wrong flight recorder settings: %s"), str);
+    set_flight(mb, keep, post);
+}
+
 int main(int argc, char *argv[]){
     /*
     if(argc == 2){
@@ -42,7 +173,9 @@ int main(int argc, char *argv[]){
         setbuf(fout, NULL);
     }*/
     initial_setup();
-    glob_pars *Glob = parse_args(argc, argv);
+    Glob = parse_args(argc, argv);
+    if(rt_setup(Glob->cpus, Glob->rtprio, Glob->mlock))
+        ERRX(_("Wrong scheduling settings"));
     if(Glob->glob_spd != 57600 && !Glob->speeds){ // user gave global speed -> test it
         conv_spd(Glob->glob_spd);
         Glob->speeds = NULL; // glob_spd have bigger priority
@@ -56,7 +189,7 @@ int main(int argc, char *argv[]){
         curno = gpamount;
         gpamount += Glob->rest_pars_num;
         // now allocate memory: gpamount + rest_pars_num + 1 for terminating NULL
-        Glob->ports = realloc(Glob->ports, gpamount + 1);
+        Glob->ports = realloc(Glob->ports, (gpamount + 1) * sizeof(char*));
         if(!Glob->ports) ERR("Realloc");
         char **ptr = Glob->rest_pars;
         //gpamount; // for terminating NULL
@@ -66,17 +199,19 @@ int main(int argc, char *argv[]){
         }
         Glob->ports[gpamount] = NULL;
     }
-    if(!Glob->ports)
+    if(!Glob->ports && !Glob->config)
         ERRX(_("You should give at least name of one port"));
     //setup_con();
-    signal(SIGHUP,  signals);
+    signal(SIGHUP,  term_reload); // reload configuration
     signal(SIGTERM, signals);   // kill (-15)
     signal(SIGINT,  signals);   // ctrl+C
     signal(SIGQUIT, signals);   // ctrl+\   .
     signal(SIGTSTP, SIG_IGN);   // ctrl+Z
+    signal(SIGPIPE, SIG_IGN);   // stdout closed
+    signal(SIGUSR2, term_trigger); // trigger of flight recorder
     setbuf(stdout, NULL);
     // now, if user gave speeds different to each port, test their amount
-    if(Glob->speeds){
+    if(Glob->speeds && Glob->ports){
         char **str = Glob->ports;
         int **spd = Glob->speeds;
         int portsamount = 0, bdramount = 0;
@@ -91,12 +226,65 @@ int main(int argc, char *argv[]){
                 portsamount, bdramount);
     }
     // open common log filename (additive)
-    if(Glob->commonlog)
+    if(Glob->workers && (Glob->shmname || Glob->listenaddr))
+        ERRX(_("Shared memory and socket outputs can't be used with workers"));
+    if(Glob->workers && Glob->matchlog) // each worker would write it
+        ERRX(_("Log of matches can't be used with workers"));
+    if(Glob->workers && Glob->flight) // supervisor writes all records into common log
+        ERRX(_("Flight recorder can't be used with workers"));
+    if(Glob->commonlog && !Glob->workers) // in supervisor mode it's written by supervisor
         set_comlogname(Glob->commonlog);
-    if(Glob->charmode)
-        set_charmode();
+    if(Glob->passthrough)
+        set_passthrough();
+    if(Glob->flush)
+        set_flush(Glob->flush);
+    set_stdqueue(Glob->quiet ? 0 : Glob->stdqueue);
+    if(Glob->flight)
+        set_flightmode(Glob->flight);
+    if(Glob->decoder && !decoder_exists(Glob->decoder))
+        ERRX(_("Wrong decoder: %s"), Glob->decoder);
+    if(Glob->encoding && (portenc = enc_byname(Glob->encoding)) < 0)
+        ERRX(_("Wrong encoding: %s"), Glob->encoding);
+    if(Glob->dedup < 0) ERRX(_("Wrong dedup time: %d"), Glob->dedup);
+    if(Glob->limit && !rl_parse(Glob->limit, &portlimit))
+        ERRX(_("Wrong rate limit: %s"), Glob->limit);
+    ratelimit comlim = {0}, stdlim = {0};
+    if(Glob->limitcommon && !rl_parse(Glob->limitcommon, &comlim))
+        ERRX(_("Wrong rate limit: %s"), Glob->limitcommon);
+    if(Glob->limitstdout && !rl_parse(Glob->limitstdout, &stdlim))
+        ERRX(_("Wrong rate limit: %s"), Glob->limitstdout);
+    set_sinklimits(&comlim, &stdlim);
+    supervisor_limits(&comlim, &stdlim);
+    if(Glob->timefmt){
+        if((timefmt = hdr_byname(Glob->timefmt)) < 0) ERRX(_("Wrong time format: %s"), Glob->timefmt);
+        set_timeformat(timefmt);
+    }
+    set_patterns(Glob->match, Glob->trigger);
+    if(Glob->matchlog)
+        set_matchlog(Glob->matchlog);
+    if(Glob->matchcolor)
+        set_matchcolor();
+    set_trigerrors(Glob->trigerrors);
+    if(Glob->durable){
+        int direct = 0;
+        if(durable_setup(Glob->durable, &direct))
+            ERRX(_("Wrong sync policy: %s"), Glob->durable);
+        if(direct) set_directio();
+    }
+    set_idxstep(Glob->idxstep);
+    set_initthreads(Glob->initthreads);
+    if(Glob->shmname)
+        set_shmname(Glob->shmname, Glob->shmsize);
+    if(Glob->listenaddr)
+        set_listenaddr(Glob->listenaddr);
+    if(Glob->workers) // run workers & merge their records
+        return supervisor_run(Glob->workers, start_worker, Glob->commonlog, rewrite_ifexists, Glob->quiet, timefmt);
+    set_portsgetter(get_ports);
+    int nports;
+    portcfg *ports = get_ports(&nports);
+    if(!ports) ERRX(_("Can't get ports' settings"));
     // now run sniffer
-    ttys_open(Glob->ports, Glob->speeds, Glob->glob_spd);
+    ttys_open(ports, nports);
     /*
     double t0 = dtime();
     while(1){
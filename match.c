@@ -0,0 +1,186 @@
+/*
+ * match.c - streaming multi-pattern matcher (Aho-Corasick automaton)
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "match.h"
+#include "usefull_macros.h"
+
+#define NOSTATE     (UINT32_MAX)
+
+static int hexdigit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Convert C-like escapes of pattern (\n, \r, \t, \\, \xHH) into bytes
+ * @param str - pattern
+ * @param out (o) - bytes (buffer should have at least strlen(str) bytes)
+ * @param len (o) - amount of bytes
+ * @return 0 if all OK
+ */
+int match_unescape(const char *str, char *out, size_t *len){
+    size_t L = 0;
+    while(*str){
+        char c = *str++;
+        if(c != '\\'){
+            out[L++] = c;
+            continue;
+        }
+        switch((c = *str++)){
+            case 'n': out[L++] = '\n'; break;
+            case 'r': out[L++] = '\r'; break;
+            case 't': out[L++] = '\t'; break;
+            case '\\': out[L++] = '\\'; break;
+            case 'x':{
+                int h = hexdigit(str[0]), l = h < 0 ? -1 : hexdigit(str[1]);
+                if(l < 0) return 1;
+                out[L++] = (char)(h << 4 | l);
+                str += 2;
+            }
+            break;
+            default:
+                return 1;
+        }
+    }
+    *len = L;
+    return 0;
+}
+
+/**
+ * Build automaton for set of patterns
+ * @param patterns - patterns (with C-like escapes)
+ * @param n        - their amount
+ * @return matcher or NULL if some pattern is wrong
+ */
+matcher *match_compile(char **patterns, int n){
+    size_t total = 1;
+    for(int i = 0; i < n; ++i) total += strlen(patterns[i]);
+    if(n < 1 || total > MATCH_MAXSTATES){
+        WARNX(_("Total length of patterns should be less than %d"), MATCH_MAXSTATES);
+        return NULL;
+    }
+    matcher *m = MALLOC(matcher, 1);
+    m->delta = MALLOC(uint32_t, total * 256);
+    m->out = MALLOC(int32_t, total);
+    m->dict = MALLOC(uint32_t, total);
+    m->hit = MALLOC(uint8_t, total);
+    m->names = MALLOC(char*, n);
+    m->lens = MALLOC(size_t, n);
+    m->npatterns = n;
+    uint32_t *fail = MALLOC(uint32_t, total), *queue = MALLOC(uint32_t, total);
+    for(size_t i = 0; i < total * 256; ++i) m->delta[i] = NOSTATE;
+    for(size_t i = 0; i < total; ++i) m->out[i] = -1;
+    m->nstates = 1;
+    char *bytes = MALLOC(char, total);
+    int bad = 0;
+    // trie of patterns
+    for(int i = 0; i < n; ++i){
+        m->names[i] = STRDUP(patterns[i]);
+        size_t L;
+        if(match_unescape(patterns[i], bytes, &L) || L == 0){
+            WARNX(_("Wrong pattern: %s"), patterns[i]);
+            bad = 1;
+            continue;
+        }
+        m->lens[i] = L;
+        uint32_t s = 0;
+        for(size_t j = 0; j < L; ++j){
+            uint32_t *next = &m->delta[(s << 8) | (uint8_t)bytes[j]];
+            if(*next == NOSTATE) *next = m->nstates++;
+            s = *next;
+        }
+        if(m->out[s] > -1){
+            WARNX(_("Duplicate pattern: %s"), patterns[i]);
+            bad = 1;
+        }
+        m->out[s] = i;
+    }
+    FREE(bytes);
+    // suffix links by breadth-first walk; missing transitions are taken from
+    // state of suffix link (its transitions are complete as it's less deep)
+    size_t qhead = 0, qtail = 0;
+    for(int c = 0; c < 256; ++c){
+        uint32_t *next = &m->delta[c];
+        if(*next == NOSTATE) *next = 0;
+        else{
+            fail[*next] = 0;
+            m->hit[*next] = m->out[*next] > -1;
+            queue[qtail++] = *next;
+        }
+    }
+    while(qhead < qtail){
+        uint32_t s = queue[qhead++];
+        for(int c = 0; c < 256; ++c){
+            uint32_t *next = &m->delta[(s << 8) | c];
+            uint32_t f = m->delta[(fail[s] << 8) | c];
+            if(*next == NOSTATE){
+                *next = f;
+                continue;
+            }
+            uint32_t ch = *next;
+            fail[ch] = f;
+            m->dict[ch] = m->out[f] > -1 ? f : m->dict[f];
+            m->hit[ch] = m->out[ch] > -1 || m->hit[f];
+            queue[qtail++] = ch;
+        }
+    }
+    FREE(fail);
+    FREE(queue);
+    if(bad) match_free(&m);
+    else DBG("%d patterns, %u states", n, m->nstates);
+    return m;
+}
+
+/**
+ * Feed data into automaton
+ * @param m     - matcher
+ * @param state - state of stream after previous data (0 for new stream)
+ * @param buf   - data
+ * @param len   - its length
+ * @param cb    - function called for each match
+ * @param arg   - its argument
+ * @return new state of stream
+ */
+uint32_t match_feed(const matcher *m, uint32_t state, const char *buf, size_t len, match_cb cb, void *arg){
+    const uint32_t *delta = m->delta;
+    const uint8_t *hit = m->hit;
+    for(size_t i = 0; i < len; ++i){
+        state = delta[(state << 8) | (uint8_t)buf[i]];
+        if(!hit[state]) continue;
+        for(uint32_t s = state; s; s = m->dict[s])
+            if(m->out[s] > -1) cb(m->out[s], i + 1, arg);
+    }
+    return state;
+}
+
+void match_free(matcher **m){
+    if(!m || !*m) return;
+    matcher *p = *m;
+    for(int i = 0; i < p->npatterns; ++i) FREE(p->names[i]);
+    FREE(p->names);
+    FREE(p->lens);
+    FREE(p->delta);
+    FREE(p->out);
+    FREE(p->dict);
+    FREE(p->hit);
+    FREE(*m);
+}
@@ -0,0 +1,56 @@
+/*
+ * match.h - streaming multi-pattern matcher (Aho-Corasick automaton)
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __MATCH_H__
+#define __MATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Patterns are compiled into DFA: each state has full table of 256 transitions,
+ * so feeding of data costs one table lookup per byte whatever amount of patterns.
+ * State of stream is single number, so matches split between reads are found too.
+ */
+
+// max total length of all patterns (amount of states)
+#define MATCH_MAXSTATES (16384)
+
+typedef struct{
+    uint32_t *delta;    // transitions: delta[state*256 + byte]
+    int32_t *out;       // pattern ending in state (-1 - none)
+    uint32_t *dict;     // next state with output by suffix links (0 - none)
+    uint8_t *hit;       // state or its suffixes have output
+    uint32_t nstates;   // amount of states
+    int npatterns;      // amount of patterns
+    char **names;       // patterns as given by user
+    size_t *lens;       // lengths of patterns
+} matcher;
+
+// called for each match: pattern number & offset of byte after it in data fed
+typedef void (*match_cb)(int pat, size_t end, void *arg);
+
+int match_unescape(const char *str, char *out, size_t *len);
+matcher *match_compile(char **patterns, int n);
+uint32_t match_feed(const matcher *m, uint32_t state, const char *buf, size_t len, match_cb cb, void *arg);
+void match_free(matcher **m);
+
+#endif // __MATCH_H__
@@ -0,0 +1,363 @@
+/*
+ * netsrv.c - local socket server: fan-out of records to live viewers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <netdb.h>          // getaddrinfo
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>        // iovec
+#include <sys/un.h>         // sockaddr_un
+#include "netsrv.h"
+#include "usefull_macros.h"
+
+// max amount of iovecs in one sendmsg()
+#define NETSRV_IOVMAX   (64)
+// max length of client's command
+#define NETSRV_CMDLEN   (256)
+
+// record: one copy for all clients
+typedef struct{
+    int refcnt;         // amount of clients which have this record in queue
+    size_t len;         // data length
+    char data[];        // header & payload
+} netrec;
+
+typedef struct{
+    int fd;             // socket
+    netrec *queue[NETSRV_QLEN]; // ring of records to send
+    size_t qhead;       // first record in queue
+    size_t qlen;        // amount of records in queue
+    size_t sent;        // amount of bytes of first record already sent
+    int filter;         // client gets only ports subscribed
+    uint8_t ports[NETSRV_MAXPORTS]; // ports subscribed
+    char cmd[NETSRV_CMDLEN]; // buffer for client's commands
+    size_t cmdlen;      // length of data in `cmd`
+    int dead;           // client should be dropped
+} client;
+
+static int listenfd = -1;
+// epoll of capture loop & tag for our events
+static int epollfd = -1;
+static uint64_t evtag = 0;
+static char *unixpath = NULL;
+static client *clients[NETSRV_MAXCLIENTS];
+static int nclients = 0;
+// names of ports by their numbers
+static char **portnames = NULL;
+static uint32_t nportnames = 0;
+// preallocated records & clients
+static mempool *recpool = NULL, *clientpool = NULL;
+
+static void unref(netrec *r){
+    if(--r->refcnt == 0) pool_put(recpool, r);
+}
+
+static void drop_client(int i){
+    client *c = clients[i];
+    DBG("drop client %d (fd=%d)", i, c->fd);
+    close(c->fd);
+    for(size_t k = 0; k < c->qlen; ++k)
+        unref(c->queue[(c->qhead + k) % NETSRV_QLEN]);
+    pool_put(clientpool, c);
+    clients[i] = clients[--nclients];
+}
+
+static void drop_dead(){
+    for(int i = nclients - 1; i > -1; --i)
+        if(clients[i]->dead) drop_client(i);
+}
+
+static int open_unix(const char *path){
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(sa.sun_path)){
+        WARNX(_("Too long socket path: %s"), path);
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        WARN("socket()");
+        return -1;
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) || listen(fd, 16)){
+        WARN(_("Can't listen on %s"), path);
+        close(fd);
+        return -1;
+    }
+    unixpath = STRDUP(path);
+    return fd;
+}
+
+static int open_tcp(const char *addr){
+    char *host = STRDUP(addr), *port = strrchr(host, ':');
+    *port++ = 0;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE}, *res;
+    int fd = -1, e = getaddrinfo(*host ? host : "127.0.0.1", port, &hints, &res);
+    if(e){
+        WARNX(_("Wrong address %s: %s"), addr, gai_strerror(e));
+        FREE(host);
+        return -1;
+    }
+    for(struct addrinfo *p = res; p; p = p->ai_next){
+        if((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(!bind(fd, p->ai_addr, p->ai_addrlen) && !listen(fd, 16)) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if(fd < 0) WARN(_("Can't listen on %s"), addr);
+    FREE(host);
+    return fd;
+}
+
+// add fd into epoll: event data would be `evtag | fd`
+static int epoll_add(int fd){
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = evtag | (uint32_t)fd};
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev)){
+        WARN("epoll_ctl()");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Open listening socket
+ * @param addr - path of UNIX socket or "[host]:port" (host by default is 127.0.0.1)
+ * @param epfd - epoll of capture loop
+ * @param tag  - event data of our fds would be `tag | fd`: call netsrv_process(fd) for them
+ * @param maxrec - max size of record (header & payload), larger records are allocated separately
+ * @return 0 if all OK
+ */
+int netsrv_open(const char *addr, int epfd, uint64_t tag, size_t maxrec){
+    if(listenfd > -1 || !addr) return 1;
+    if(strchr(addr, '/') || !strchr(addr, ':')) listenfd = open_unix(addr);
+    else listenfd = open_tcp(addr);
+    if(listenfd < 0) return 1;
+    fcntl(listenfd, F_SETFL, O_NONBLOCK);
+    epollfd = epfd;
+    evtag = tag;
+    if(epoll_add(listenfd)){
+        close(listenfd);
+        listenfd = -1;
+        return 1;
+    }
+    // records & clients are preallocated, so capture loop won't call malloc()
+    size_t blksz = sizeof(netrec) + maxrec, nblocks = NETSRV_POOLSZ / blksz;
+    if(nblocks < NETSRV_MINRECS) nblocks = NETSRV_MINRECS;
+    recpool = pool_create(blksz, nblocks);
+    clientpool = pool_create(sizeof(client), NETSRV_MAXCLIENTS);
+    DBG("listen on %s", addr);
+    return 0;
+}
+
+/**
+ * Set name of port with number `port`
+ */
+void netsrv_setport(uint32_t port, const char *name){
+    if(port >= nportnames){
+        portnames = REALLOC(portnames, char*, port + 1);
+        memset(&portnames[nportnames], 0, (port + 1 - nportnames) * sizeof(char*));
+        nportnames = port + 1;
+    }
+    FREE(portnames[port]);
+    portnames[port] = STRDUP(name);
+}
+
+static int subscribed(client *c, uint32_t port){
+    if(!c->filter || port >= NETSRV_MAXPORTS) return TRUE;
+    return c->ports[port];
+}
+
+/**
+ * Add record into queues of all clients subscribed to `port`
+ * client with full queue (stuck) would be dropped
+ * @param port  - port number
+ * @param hdr   - header
+ * @param hlen  - its length
+ * @param data  - payload
+ * @param len   - its length
+ * @param addnl - add '\n' after payload
+ */
+void netsrv_put(uint32_t port, const char *hdr, size_t hlen, const char *data, size_t len, int addnl){
+    netrec *r = NULL;
+    int ndead = 0;
+    for(int i = 0; i < nclients; ++i){
+        client *c = clients[i];
+        if(c->dead || !subscribed(c, port)) continue;
+        if(c->qlen == NETSRV_QLEN){
+            WARNX(_("Client %d is too slow, drop it"), c->fd);
+            c->dead = 1;
+            ++ndead;
+            continue;
+        }
+        if(!r){
+            size_t L = hlen + len + (addnl ? 1 : 0);
+            r = pool_get(recpool, sizeof(netrec) + L);
+            r->refcnt = 0;
+            r->len = L;
+            memcpy(r->data, hdr, hlen);
+            memcpy(r->data + hlen, data, len);
+            if(addnl) r->data[L - 1] = '\n';
+        }
+        ++r->refcnt;
+        c->queue[(c->qhead + c->qlen++) % NETSRV_QLEN] = r;
+    }
+    if(ndead) drop_dead();
+}
+
+static int findport(const char *name){
+    const char *b = strrchr(name, '/');
+    b = b ? b + 1 : name;
+    for(uint32_t i = 0; i < nportnames; ++i){
+        if(!portnames[i]) continue;
+        if(!strcmp(portnames[i], name)) return i;
+        const char *p = strrchr(portnames[i], '/');
+        if(!strcmp(p ? p + 1 : portnames[i], b)) return i;
+    }
+    return -1;
+}
+
+// "+port", "-port" or "*"
+static void client_cmd(client *c, char *cmd){
+    DBG("client %d: '%s'", c->fd, cmd);
+    if(!*cmd) return;
+    if(*cmd == '*' && !cmd[1]){
+        c->filter = 0;
+        return;
+    }
+    if(*cmd != '+' && *cmd != '-') return;
+    int port = findport(cmd + 1);
+    if(port < 0 || port >= NETSRV_MAXPORTS) return;
+    if(!c->filter){
+        memset(c->ports, 0, sizeof(c->ports));
+        c->filter = 1;
+    }
+    c->ports[port] = (*cmd == '+');
+}
+
+static void client_read(client *c){
+    ssize_t L = read(c->fd, c->cmd + c->cmdlen, NETSRV_CMDLEN - 1 - c->cmdlen);
+    if(L <= 0){
+        if(L < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        c->dead = 1;
+        return;
+    }
+    c->cmdlen += L;
+    c->cmd[c->cmdlen] = 0;
+    char *start = c->cmd, *nl;
+    while((nl = strchr(start, '\n'))){
+        *nl = 0;
+        if(nl > start && nl[-1] == '\r') nl[-1] = 0;
+        client_cmd(c, start);
+        start = nl + 1;
+    }
+    c->cmdlen -= start - c->cmd;
+    if(c->cmdlen == NETSRV_CMDLEN - 1) c->cmdlen = 0; // too long string - omit it
+    memmove(c->cmd, start, c->cmdlen);
+}
+
+/**
+ * Accept new clients or read commands of old
+ * @param fd - file descriptor from epoll event
+ */
+void netsrv_process(int fd){
+    if(listenfd < 0) return;
+    if(fd != listenfd){
+        for(int i = 0; i < nclients; ++i)
+            if(clients[i]->fd == fd) client_read(clients[i]);
+        drop_dead();
+        return;
+    }
+    while((fd = accept(listenfd, NULL, NULL)) > -1){
+        if(nclients == NETSRV_MAXCLIENTS){
+            WARNX(_("Too much clients"));
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        if(epoll_add(fd)){
+            close(fd);
+            continue;
+        }
+        client *c = pool_get(clientpool, sizeof(client));
+        memset(c, 0, sizeof(client));
+        c->fd = fd;
+        clients[nclients++] = c;
+        DBG("new client, fd=%d", fd);
+    }
+}
+
+/**
+ * Send queued data to all clients (never blocks)
+ */
+static void client_send(client *c){
+    while(c->qlen){
+        struct iovec iov[NETSRV_IOVMAX];
+        size_t n;
+        for(n = 0; n < c->qlen && n < NETSRV_IOVMAX; ++n){
+            netrec *r = c->queue[(c->qhead + n) % NETSRV_QLEN];
+            size_t skip = n ? 0 : c->sent;
+            iov[n].iov_base = r->data + skip;
+            iov[n].iov_len = r->len - skip;
+        }
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n};
+        ssize_t w = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(w < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) c->dead = 1;
+            return;
+        }
+        while(w > 0){
+            netrec *r = c->queue[c->qhead];
+            size_t rest = r->len - c->sent;
+            if((size_t)w < rest){
+                c->sent += w;
+                return; // socket buffer is full
+            }
+            w -= rest;
+            unref(r);
+            c->qhead = (c->qhead + 1) % NETSRV_QLEN;
+            --c->qlen;
+            c->sent = 0;
+        }
+    }
+}
+
+void netsrv_flush(){
+    for(int i = 0; i < nclients; ++i) client_send(clients[i]);
+    drop_dead();
+}
+
+void netsrv_close(){
+    netsrv_flush(); // send rest of data if clients are ready
+    while(nclients) drop_client(0);
+    if(listenfd > -1) close(listenfd);
+    listenfd = -1;
+    if(unixpath){
+        unlink(unixpath);
+        FREE(unixpath);
+    }
+    for(uint32_t i = 0; i < nportnames; ++i) FREE(portnames[i]);
+    FREE(portnames);
+    nportnames = 0;
+    pool_destroy(&recpool);
+    pool_destroy(&clientpool);
+}
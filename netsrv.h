@@ -0,0 +1,51 @@
+/*
+ * netsrv.h - local socket server: fan-out of records to live viewers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __NETSRV_H__
+#define __NETSRV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Clients get records in common log format ("time: port\npayload\n").
+ * Client can send lines "+port" (subscribe to port: after first subscription
+ * client gets only ports subscribed), "-port" (unsubscribe) or "*" (all ports).
+ */
+
+// max amount of clients
+#define NETSRV_MAXCLIENTS   (64)
+// max amount of records in client's queue: client is dropped if queue overfulls
+#define NETSRV_QLEN         (4096)
+// max amount of ports client can subscribe to
+#define NETSRV_MAXPORTS     (1024)
+// memory preallocated for records & minimal amount of them
+#define NETSRV_POOLSZ       (8*1024*1024)
+#define NETSRV_MINRECS      (256)
+
+int netsrv_open(const char *addr, int epfd, uint64_t tag, size_t maxrec);
+void netsrv_setport(uint32_t port, const char *name);
+void netsrv_put(uint32_t port, const char *hdr, size_t hlen, const char *data, size_t len, int addnl);
+void netsrv_process(int fd);
+void netsrv_flush();
+void netsrv_close();
+
+#endif // __NETSRV_H__
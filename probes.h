@@ -0,0 +1,57 @@
+/*
+ * probes.h - static tracepoints (USDT) of capture path
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/*
+ * Probes of provider "multiterm" (for perf, bpftrace, systemtap), when
+ * <sys/sdt.h> isn't available (or NO_SDT defined) they are empty:
+ *      wait_start()                    - before epoll_wait()
+ *      wait_end(nevents)               - after it
+ *      read_start(port)                - before read() of port (port is index of descriptor)
+ *      read_end(port, bytes)           - after it (bytes < 0 - error)
+ *      record(port, len, addnl)        - record is framed & passed to outputs
+ *      sink_flush(fd, bytes)           - output is flushed
+ *      sink_write(fd, bytes, written)  - write()/pwrite() of output
+ * Disabled probe is a single nop, so it's always compiled in.
+ */
+
+#if !defined(NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#define PROBE0(name)            DTRACE_PROBE(multiterm, name)
+#define PROBE1(name, a)         DTRACE_PROBE1(multiterm, name, a)
+#define PROBE2(name, a, b)      DTRACE_PROBE2(multiterm, name, a, b)
+#define PROBE3(name, a, b, c)   DTRACE_PROBE3(multiterm, name, a, b, c)
+#else
+#define PROBE0(name)            do{}while(0)
+#define PROBE1(name, a)         do{ (void)(a); }while(0)
+#define PROBE2(name, a, b)      do{ (void)(a); (void)(b); }while(0)
+#define PROBE3(name, a, b, c)   do{ (void)(a); (void)(b); (void)(c); }while(0)
+#endif
+
+#endif // __PROBES_H__
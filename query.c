@@ -0,0 +1,371 @@
+/*
+ * query.c - parallel search/filter over mmaped logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#define _GNU_SOURCE         // memmem, memrchr
+#include <ctype.h>          // isxdigit
+#include <float.h>          // DBL_MAX
+#include <pthread.h>
+#include <regex.h>
+#include "query.h"
+
+// minimal size of data processed by one worker at once
+#define CHUNK_MINSZ     (1<<20)
+
+// found record
+typedef struct{
+    double t;           // its time
+    size_t off;         // its offset
+} match;
+
+// part of log (starting and ending on record boundaries) processed by one worker
+typedef struct{
+    logsrc *src;        // log file
+    size_t start;       // offset of first record
+    size_t end;         // offset after last record
+    match *res;         // records found
+    size_t N;           // their amount
+    size_t sz;          // size of `res`
+} chunk;
+
+// all chunks of all files
+static chunk *chunks = NULL;
+static size_t nchunks = 0, chunkssz = 0;
+// number of next chunk to process
+static size_t nextchunk = 0;
+// current filter
+static logfilter *filter = NULL;
+
+/**
+ * Open log file, mmap it & load its index
+ * @param name    - filename
+ * @param idxstep - index step if index should be built
+ * @return log source or NULL
+ */
+logsrc *logsrc_open(char *name, uint32_t idxstep){
+    mmapbuf *b = My_mmap(name);
+    if(!b) return NULL;
+    logsrc *s = MALLOC(logsrc, 1);
+    s->name = name;
+    s->port = log_portname(name);
+    s->map = b;
+    s->idx = logidx_load(name, b, idxstep);
+    s->ts = -DBL_MAX;
+    s->te = DBL_MAX;
+    return s;
+}
+
+void logsrc_close(logsrc **src){
+    if(!src || !*src) return;
+    logsrc *s = *src;
+    FREE(s->port);
+    logidx_free(&s->idx);
+    My_munmap(s->map);
+    FREE(*src);
+}
+
+/**
+ * Get port name from log filename: "path/log_<port>.txt"
+ * @return allocated string
+ */
+char *log_portname(const char *logname){
+    const char *b = strrchr(logname, '/');
+    b = b ? b + 1 : logname;
+    if(strncmp(b, "log_", 4) == 0 && b[4]) b += 4;
+    char *p = strdup(b);
+    size_t L = strlen(p);
+    if(L > 4 && strcmp(p + L - 4, ".txt") == 0) p[L - 4] = 0;
+    return p;
+}
+
+/**
+ * Check if port name (full path or basename) is in list
+ * @param port  - port name (not NULL-terminated)
+ * @param len   - its length
+ * @param ports - NULL-terminated list or NULL (any port matches)
+ * @return TRUE if port is in list
+ */
+int portmatch(const char *port, size_t len, char **ports){
+    if(!ports) return TRUE;
+    const char *b = memrchr(port, '/', len);
+    if(b){
+        ++b;
+        len -= b - port;
+        port = b;
+    }
+    for(; *ports; ++ports){
+        const char *p = strrchr(*ports, '/');
+        p = p ? p + 1 : *ports;
+        if(strlen(p) == len && !memcmp(p, port, len)) return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Convert string like "DEADBEEF", "de ad be ef" or "0xde,0xad" into bytes
+ * @param str - string with hex bytes
+ * @param len (o) - amount of bytes
+ * @return allocated array or NULL in case of error
+ */
+uint8_t *hex2bytes(const char *str, size_t *len){
+    size_t L = strlen(str), N = 0;
+    uint8_t *bytes = MALLOC(uint8_t, L / 2 + 1);
+    while(*str){
+        if(isspace(*str) || *str == ',' || *str == ':'){ ++str; continue; }
+        if(str[0] == '0' && (str[1] == 'x' || str[1] == 'X')){ str += 2; continue; }
+        if(!isxdigit(str[0]) || !isxdigit(str[1])){
+            WARNX(_("Wrong hex string"));
+            FREE(bytes);
+            return NULL;
+        }
+        char byte[3] = {str[0], str[1], 0};
+        bytes[N++] = (uint8_t) strtol(byte, NULL, 16);
+        str += 2;
+    }
+    if(!N){
+        WARNX(_("Empty hex string"));
+        FREE(bytes);
+        return NULL;
+    }
+    *len = N;
+    return bytes;
+}
+
+static void add_chunk(logsrc *s, size_t start, size_t end){
+    if(nchunks == chunkssz){
+        chunkssz += 256;
+        chunks = realloc(chunks, chunkssz * sizeof(chunk));
+        if(!chunks) ERR("realloc");
+    }
+    chunk *c = &chunks[nchunks++];
+    memset(c, 0, sizeof(chunk));
+    c->src = s;
+    c->start = start;
+    c->end = end;
+}
+
+/**
+ * Split time ranges of all logs into chunks by index entries
+ * @return amount of chunks
+ */
+static size_t make_chunks(logsrc **src, int nsrc, int nthreads){
+    size_t *starts = MALLOC(size_t, nsrc), *ends = MALLOC(size_t, nsrc), total = 0;
+    for(int i = 0; i < nsrc; ++i){
+        logsrc *s = src[i];
+        logrec r;
+        // file of other port
+        if(log_getrec(s->map, 0, &r) && !r.port && !portmatch(s->port, strlen(s->port), filter->ports))
+            continue;
+        starts[i] = logidx_find(s->idx, s->ts);
+        ends[i] = logidx_after(s->idx, s->te, s->map->len);
+        if(ends[i] > starts[i]) total += ends[i] - starts[i];
+    }
+    size_t chunksz = total / (nthreads * 8);
+    if(chunksz < CHUNK_MINSZ) chunksz = CHUNK_MINSZ;
+    DBG("total: %zd bytes, chunk: %zd", total, chunksz);
+    for(int i = 0; i < nsrc; ++i){
+        if(ends[i] <= starts[i]) continue;
+        logidx *idx = src[i]->idx;
+        size_t cur = starts[i];
+        for(size_t e = 0; e < idx->N; ++e){
+            size_t off = idx->entries[e].offset;
+            if(off >= ends[i]) break;
+            if(off > cur && off - cur >= chunksz){
+                add_chunk(src[i], cur, off);
+                cur = off;
+            }
+        }
+        add_chunk(src[i], cur, ends[i]);
+    }
+    FREE(starts); FREE(ends);
+    return nchunks;
+}
+
+static int recmatch(logrec *r, regex_t *re){
+    if(r->port && !portmatch(r->port, r->portlen, filter->ports)) return FALSE;
+    if(filter->literal && !memmem(r->data, r->len, filter->literal, strlen(filter->literal))) return FALSE;
+    if(filter->bytes && !memmem(r->data, r->len, filter->bytes, filter->nbytes)) return FALSE;
+    if(re){
+        regmatch_t m = {.rm_so = 0, .rm_eo = r->len};
+        if(regexec(re, r->data, 1, &m, REG_STARTEND)) return FALSE;
+    }
+    return TRUE;
+}
+
+static void scan_chunk(chunk *c, regex_t *re){
+    logsrc *s = c->src;
+    size_t off = c->start;
+    logrec r;
+    while(off < c->end && log_getrec(s->map, off, &r)){
+        if(r.t > s->te) break;
+        if(r.t >= s->ts && recmatch(&r, re)){
+            if(c->N == c->sz){
+                c->sz += 1024;
+                c->res = realloc(c->res, c->sz * sizeof(match));
+                if(!c->res) ERR("realloc");
+            }
+            c->res[c->N].t = r.t;
+            c->res[c->N++].off = off;
+        }
+        off = r.next;
+    }
+}
+
+static void *worker(_U_ void *arg){
+    regex_t re, *pre = NULL;
+    // each thread have its own copy of regex: regexec() locks compiled pattern
+    if(filter->regex && !regcomp(&re, filter->regex, REG_EXTENDED | REG_NOSUB)) pre = &re;
+    size_t i;
+    while((i = __atomic_fetch_add(&nextchunk, 1, __ATOMIC_RELAXED)) < nchunks)
+        scan_chunk(&chunks[i], pre);
+    if(pre) regfree(pre);
+    return NULL;
+}
+
+// cursor of merging: current match of one log
+typedef struct{
+    size_t ci;          // current chunk
+    size_t ce;          // chunk after last chunk of this log
+    size_t i;           // current match in chunk
+} cursor;
+
+static inline double curtime(cursor *c){
+    return chunks[c->ci].res[c->i].t;
+}
+
+// skip empty chunks, return FALSE if there's no more matches
+static int cursor_check(cursor *c){
+    while(c->ci < c->ce && c->i >= chunks[c->ci].N){
+        ++c->ci;
+        c->i = 0;
+    }
+    return c->ci < c->ce;
+}
+
+static void heap_down(cursor **heap, int N, int i){
+    while(1){
+        int l = 2*i + 1, r = l + 1, m = i;
+        if(l < N && curtime(heap[l]) < curtime(heap[m])) m = l;
+        if(r < N && curtime(heap[r]) < curtime(heap[m])) m = r;
+        if(m == i) return;
+        cursor *tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+// arguments of put_record()
+typedef struct{
+    FILE *out;          // output stream
+    int addport;        // add port name to headers of per-port logs
+    int rawout;         // output only payload
+} putargs;
+
+static int put_record(logsrc *s, logrec *r, void *arg){
+    putargs *a = (putargs*)arg;
+    if(a->rawout) fwrite(r->data, 1, r->len + 1, a->out);
+    else if(a->addport && !r->port){ // "time: port" header like in common log
+        fwrite(r->hdr, 1, r->data - r->hdr - 1, a->out);
+        fprintf(a->out, ": %s\n", s->port);
+        fwrite(r->data, 1, r->len + 1, a->out);
+    }else fwrite(r->hdr, 1, r->data + r->len + 1 - r->hdr, a->out);
+    return 0;
+}
+
+/**
+ * Search records of all logs in parallel & pass them to `cb` in time order
+ * @param src      - opened logs with time ranges
+ * @param nsrc     - their amount
+ * @param f        - filter
+ * @param nthreads - amount of workers
+ * @param cb       - callback for each record found (returns nonzero to stop)
+ * @param arg      - its argument
+ * @return amount of records passed or -1 in case of error
+ */
+long long query_foreach(logsrc **src, int nsrc, logfilter *f, int nthreads, query_cb cb, void *arg){
+    if(!src || nsrc < 1 || !f || !cb) return -1;
+    filter = f;
+    if(f->regex){ // check regex
+        regex_t re;
+        int e = regcomp(&re, f->regex, REG_EXTENDED | REG_NOSUB);
+        if(e){
+            char errbuf[256];
+            regerror(e, &re, errbuf, 256);
+            WARNX(_("Wrong regex \"%s\": %s"), f->regex, errbuf);
+            return -1;
+        }
+        regfree(&re);
+    }
+    if(nthreads < 1) nthreads = 1;
+    make_chunks(src, nsrc, nthreads);
+    if((size_t)nthreads > nchunks) nthreads = (int)nchunks;
+    DBG("%zd chunks, %d threads", nchunks, nthreads);
+    if(nthreads > 1){
+        pthread_t *threads = MALLOC(pthread_t, nthreads);
+        for(int i = 0; i < nthreads; ++i)
+            if(pthread_create(&threads[i], NULL, worker, NULL)) ERR(_("Can't create thread"));
+        for(int i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+        FREE(threads);
+    }else worker(NULL);
+    // merge results: chunks of each log are sorted, so use a heap of logs' cursors
+    cursor *cursors = MALLOC(cursor, nsrc + 1), **heap = MALLOC(cursor*, nsrc + 1);
+    int N = 0;
+    for(size_t ci = 0; ci < nchunks;){
+        size_t ce = ci;
+        while(ce < nchunks && chunks[ce].src == chunks[ci].src) ++ce;
+        cursor *c = &cursors[N];
+        c->ci = ci; c->ce = ce; c->i = 0;
+        if(cursor_check(c)) heap[N++] = c;
+        ci = ce;
+    }
+    for(int i = N / 2 - 1; i >= 0; --i) heap_down(heap, N, i);
+    long long found = 0;
+    while(N){
+        cursor *c = heap[0];
+        chunk *ch = &chunks[c->ci];
+        logrec r;
+        if(log_getrec(ch->src->map, ch->res[c->i].off, &r)){
+            ++found;
+            if(cb(ch->src, &r, arg)) break;
+        }
+        ++c->i;
+        if(!cursor_check(c)) heap[0] = heap[--N];
+        heap_down(heap, N, 0);
+    }
+    FREE(cursors); FREE(heap);
+    for(size_t i = 0; i < nchunks; ++i) FREE(chunks[i].res);
+    FREE(chunks);
+    nchunks = chunkssz = nextchunk = 0;
+    return found;
+}
+
+/**
+ * Search records of all logs in parallel & output them in time order
+ * @param src      - opened logs with time ranges
+ * @param nsrc     - their amount
+ * @param f        - filter
+ * @param nthreads - amount of workers
+ * @param out      - output stream
+ * @param rawout   - output only payload
+ * @return amount of records found or -1 in case of error
+ */
+long long query_run(logsrc **src, int nsrc, logfilter *f, int nthreads, FILE *out, int rawout){
+    if(!out) return -1;
+    putargs a = {.out = out, .addport = nsrc > 1, .rawout = rawout};
+    return query_foreach(src, nsrc, f, nthreads, put_record, &a);
+}
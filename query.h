@@ -0,0 +1,58 @@
+/*
+ * query.h - parallel search/filter over mmaped logs
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include <stdio.h>
+#include "logfile.h"
+
+// opened log file
+typedef struct{
+    char *name;         // log filename
+    char *port;         // port name (got from filename)
+    mmapbuf *map;       // mmaped file
+    logidx *idx;        // its index
+    double ts;          // start of time range
+    double te;          // end of time range
+} logsrc;
+
+// filters for records (all non-empty filters should match)
+typedef struct{
+    char **ports;       // NULL-terminated list of ports or NULL
+    char *literal;      // substring of payload or NULL
+    char *regex;        // extended regular expression for payload or NULL
+    uint8_t *bytes;     // byte pattern or NULL
+    size_t nbytes;      // its length
+} logfilter;
+
+// callback for records found: return nonzero to stop
+typedef int (*query_cb)(logsrc *s, logrec *r, void *arg);
+
+logsrc *logsrc_open(char *name, uint32_t idxstep);
+void logsrc_close(logsrc **src);
+char *log_portname(const char *logname);
+int portmatch(const char *port, size_t len, char **ports);
+uint8_t *hex2bytes(const char *str, size_t *len);
+long long query_foreach(logsrc **src, int nsrc, logfilter *f, int nthreads, query_cb cb, void *arg);
+long long query_run(logsrc **src, int nsrc, logfilter *f, int nthreads, FILE *out, int rawout);
+
+#endif // __QUERY_H__
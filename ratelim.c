@@ -0,0 +1,107 @@
+/*
+ * ratelim.c - token bucket limits of records' rate
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "parseargs.h"
+#include "ratelim.h"
+#include "usefull_macros.h"
+
+/**
+ * Parse limits like "bytes=N,recs=N,sample=N,full"
+ * @param str - string with limits
+ * @param l (o) - limits
+ * @return FALSE if string is wrong
+ */
+int rl_parse(char *str, ratelimit *l){
+    ratelimit r = {0};
+    mysuboption limopts[] = {
+        {"bytes",   NEED_ARG,   arg_int,    &r.bytes},
+        {"recs",    NEED_ARG,   arg_int,    &r.recs},
+        {"sample",  NEED_ARG,   arg_int,    &r.sample},
+        {"full",    NO_ARGS,    arg_none,   &r.full},
+        end_suboption
+    };
+    if(!get_suboption(str, limopts) || r.bytes < 0 || r.recs < 0 || r.sample < 0) return FALSE;
+    *l = r;
+    return TRUE;
+}
+
+// check if any limit is set
+int rl_active(const ratelimit *l){
+    return l->bytes > 0 || l->recs > 0;
+}
+
+/**
+ * Init bucket (it's full at start)
+ * @param b - bucket
+ * @param l - limits
+ * @param t - current time
+ */
+void tb_init(tbucket *b, const ratelimit *l, double t){
+    memset(b, 0, sizeof(tbucket));
+    b->lim = *l;
+    b->tbytes = l->bytes;
+    b->trecs = l->recs;
+    b->last = t;
+}
+
+/**
+ * Check if record can pass and take its tokens (or count it as dropped)
+ * @param b   - bucket
+ * @param t   - time of record
+ * @param len - its size
+ * @return 1 if record passes
+ */
+int tb_pass(tbucket *b, double t, size_t len){
+    const ratelimit *l = &b->lim;
+    if(t > b->last){ // times of records of different ports could be a bit unordered
+        double dt = t - b->last;
+        b->tbytes += dt * l->bytes;
+        b->trecs += dt * l->recs;
+        if(b->tbytes > l->bytes) b->tbytes = l->bytes;
+        if(b->trecs > l->recs) b->trecs = l->recs;
+        b->last = t;
+    }
+    if((!l->bytes || b->tbytes > 0.) && (!l->recs || b->trecs >= 1.)){
+        if(l->bytes) b->tbytes -= len;
+        if(l->recs) b->trecs -= 1.;
+        return 1;
+    }
+    if(l->sample && ++b->over >= (uint32_t)l->sample){ // sampled record
+        b->over = 0;
+        return 1;
+    }
+    ++b->dropped; ++b->total;
+    b->droppedbytes += len; b->totalbytes += len;
+    return 0;
+}
+
+/**
+ * Make marker about records dropped since previous marker
+ * @param b   - bucket
+ * @param buf (o) - buffer for marker (RL_MARKERLEN bytes)
+ * @return length of marker or 0 if nothing was dropped
+ */
+size_t tb_marker(tbucket *b, char *buf){
+    if(!b->dropped) return 0;
+    int L = snprintf(buf, RL_MARKERLEN, "rate limit: %llu records (%llu bytes) dropped",
+        (unsigned long long)b->dropped, (unsigned long long)b->droppedbytes);
+    b->dropped = b->droppedbytes = 0;
+    return (size_t)L;
+}
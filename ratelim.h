@@ -0,0 +1,65 @@
+/*
+ * ratelim.h - token bucket limits of records' rate
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __RATELIM_H__
+#define __RATELIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bucket gets `bytes` and `recs` tokens per second (burst - one second of
+ * traffic); record passes if there's tokens left (so bucket can get into debt
+ * with big record, but mean rate stays right). Records over limit are dropped,
+ * but each `sample`-th of them passes anyway.
+ */
+
+// limits given by user (0 - no limit)
+typedef struct{
+    int bytes;          // bytes per second
+    int recs;           // records per second
+    int sample;         // pass each N-th record over limit (0 - drop all)
+    int full;           // port's log stays complete (limit only shared outputs)
+} ratelimit;
+
+typedef struct{
+    ratelimit lim;      // limits
+    double tbytes;      // tokens of bytes
+    double trecs;       // tokens of records
+    double last;        // time of last refill
+    uint32_t over;      // amount of records over limit since last sampled
+    uint64_t dropped;   // amount of records dropped since last marker
+    uint64_t droppedbytes; // and their size
+    uint64_t total;     // total amount of records dropped
+    uint64_t totalbytes;// and their size
+} tbucket;
+
+// max length of marker & name of port in headers of markers in shared outputs
+#define RL_MARKERLEN    (128)
+#define RL_PORTNAME     "rate-limit"
+
+int rl_parse(char *str, ratelimit *l);
+int rl_active(const ratelimit *l);
+void tb_init(tbucket *b, const ratelimit *l, double t);
+int tb_pass(tbucket *b, double t, size_t len);
+size_t tb_marker(tbucket *b, char *buf);
+
+#endif // __RATELIM_H__
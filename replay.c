@@ -0,0 +1,248 @@
+/*
+ * replay.c - timed replay of captured logs into pty or serial devices
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <inttypes.h>       // PRIu64
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include "replay.h"
+
+// destination of one port
+typedef struct{
+    char *port;         // port name (NULL for plain destination)
+    char *dest;         // "pty" or path
+    int fd;             // opened descriptor or -1
+    int slave;          // slave side of pty (kept opened) or -1
+    int used;           // plain destination is given to some port
+    uint64_t nrec;      // amount of records written
+    uint64_t nbytes;    // amount of bytes written
+} route;
+
+// port met in logs
+typedef struct{
+    const char *name;   // its name (points into log or logsrc)
+    size_t len;         // length of name
+    route *r;           // its destination or NULL if port is skipped
+} rport;
+
+static route routes[REPLAY_MAXPORTS];
+static int nroutes = 0;
+static rport ports[REPLAY_MAXPORTS];
+static int nports = 0;
+static volatile int stop = 0;
+
+static void onstop(_U_ int sig){
+    stop = 1;
+}
+
+// open destination of route, return FALSE if failed
+static int route_open(route *r){
+    struct termios t;
+    if(strcmp(r->dest, "pty") == 0){
+        char *slavename = NULL;
+        r->fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if(r->fd < 0 || grantpt(r->fd) || unlockpt(r->fd) || !(slavename = ptsname(r->fd))){
+            WARN(_("Can't create pty"));
+            return FALSE;
+        }
+        // keep slave opened, so writes won't fail before reader connects
+        if((r->slave = open(slavename, O_RDWR | O_NOCTTY)) < 0){
+            WARN(_("Can't open %s"), slavename);
+            return FALSE;
+        }
+        if(!tcgetattr(r->slave, &t)){
+            cfmakeraw(&t);
+            tcsetattr(r->slave, TCSANOW, &t);
+        }
+        FREE(r->dest);
+        r->dest = strdup(slavename);
+        printf("%s -> %s\n", r->port ? r->port : "", r->dest);
+        fflush(stdout);
+        return TRUE;
+    }
+    // O_NONBLOCK: don't wait for carrier of serial port;
+    // no O_CREAT: mistyped name of device shouldn't become a regular file
+    if((r->fd = open(r->dest, O_WRONLY | O_NOCTTY | O_NONBLOCK)) < 0){
+        WARN(_("Can't open %s"), r->dest);
+        return FALSE;
+    }
+    fcntl(r->fd, F_SETFL, 0);
+    struct stat st;
+    if(!fstat(r->fd, &st) && S_ISREG(st.st_mode) && ftruncate(r->fd, 0))
+        WARN(_("Can't truncate %s"), r->dest);
+    if(isatty(r->fd) && !tcgetattr(r->fd, &t)){ // keep speed of device, but make it raw
+        cfmakeraw(&t);
+        if(tcsetattr(r->fd, TCSANOW, &t)) WARN(_("Can't setup %s"), r->dest);
+    }
+    return TRUE;
+}
+
+// parse routes given by user
+static void routes_setup(char **list){
+    for(; list && *list && nroutes < REPLAY_MAXPORTS; ++list){
+        route *r = &routes[nroutes++];
+        char *eq = strchr(*list, '=');
+        if(eq){
+            r->port = strndup(*list, eq - *list);
+            r->dest = strdup(eq + 1);
+        }else r->dest = strdup(*list);
+        r->fd = r->slave = -1;
+    }
+}
+
+// find destination of port `name`, open it if needed
+static route *port_route(const char *name, size_t len){
+    for(int i = 0; i < nports; ++i)
+        if(ports[i].len == len && !memcmp(ports[i].name, name, len)) return ports[i].r;
+    if(nports == REPLAY_MAXPORTS) return NULL;
+    rport *p = &ports[nports++];
+    p->name = name; p->len = len; p->r = NULL;
+    char pname[256];
+    snprintf(pname, sizeof(pname), "%.*s", (int)len, name);
+    route *r = NULL;
+    for(int i = 0; i < nroutes && !r; ++i){ // explicit route
+        char *one[2] = {routes[i].port, NULL};
+        if(routes[i].port && portmatch(name, len, one)) r = &routes[i];
+    }
+    for(int i = 0; i < nroutes && !r; ++i) // next plain destination
+        if(!routes[i].port && !routes[i].used) r = &routes[i];
+    if(!r && !nroutes && nroutes < REPLAY_MAXPORTS){ // no routes given: pty for each port
+        r = &routes[nroutes++];
+        r->dest = strdup("pty");
+        r->fd = r->slave = -1;
+    }
+    if(!r){
+        WARNX(_("Port %s have no destination, skipped"), pname);
+        return NULL;
+    }
+    if(!r->port) r->port = strdup(pname);
+    r->used = TRUE;
+    if(r->fd < 0 && !route_open(r)) r->fd = -2; // don't try again
+    if(r->fd < 0) return NULL;
+    p->r = r;
+    return r;
+}
+
+static int write_all(int fd, const char *data, size_t len){
+    while(len){
+        ssize_t l = write(fd, data, len);
+        if(l < 0){
+            if(errno == EINTR){
+                if(stop) return FALSE;
+                continue;
+            }
+            return FALSE;
+        }
+        data += l; len -= l;
+    }
+    return TRUE;
+}
+
+// state of replay
+typedef struct{
+    double speed;           // speed factor (0 - as fast as possible)
+    int rawout;             // don't add '\n' after payload
+    int started;            // first record written
+    double tfirst;          // time of first record
+    struct timespec start;  // monotonic time of first record
+    double maxlate;         // max lateness of writing (seconds)
+} replay;
+
+// add seconds to timespec
+static struct timespec ts_add(struct timespec t, double s){
+    long long ns = (long long)(s * 1e9);
+    t.tv_sec += ns / 1000000000LL;
+    t.tv_nsec += ns % 1000000000LL;
+    if(t.tv_nsec >= 1000000000L){ ++t.tv_sec; t.tv_nsec -= 1000000000L; }
+    return t;
+}
+
+static int replay_record(logsrc *s, logrec *r, void *arg){
+    replay *R = (replay*)arg;
+    if(stop) return 1;
+    route *dst = r->port ? port_route(r->port, r->portlen) : port_route(s->port, strlen(s->port));
+    if(!dst) return 0;
+    // UNIX time for logs of relative time, so several captures are merged right
+    double t = r->t;
+    if(!(s->idx->hdr.flags & IDX_ABSTIME)) t += s->idx->hdr.t0;
+    if(!R->started){
+        clock_gettime(CLOCK_MONOTONIC, &R->start);
+        R->tfirst = t;
+        R->started = TRUE;
+    }else if(R->speed > 0. && t > R->tfirst){
+        // absolute deadlines: errors of sleeping don't accumulate
+        struct timespec dl = ts_add(R->start, (t - R->tfirst) / R->speed), now;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &dl, NULL) == EINTR)
+            if(stop) return 1;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double late = (double)(now.tv_sec - dl.tv_sec) + (now.tv_nsec - dl.tv_nsec) * 1e-9;
+        if(late > R->maxlate) R->maxlate = late;
+    }
+    int nl = !R->rawout && !r->addnl; // don't write '\n' which wasn't received
+    if(!write_all(dst->fd, r->data, r->len) || (nl && !write_all(dst->fd, "\n", 1))){
+        if(!stop) WARN(_("Can't write to %s"), dst->dest);
+        return 1;
+    }
+    ++dst->nrec;
+    dst->nbytes += r->len + nl;
+    return 0;
+}
+
+/**
+ * Replay records of logs into destinations
+ * @param src    - opened logs with time ranges
+ * @param nsrc   - their amount
+ * @param f      - filter of records
+ * @param list   - NULL-terminated list of routes ("port=dest" or "dest") or NULL
+ * @param speed  - speed factor (0 - as fast as possible)
+ * @param rawout - write only payload (without any '\n' after it)
+ * @return amount of records written or -1 in case of error
+ */
+long long replay_run(logsrc **src, int nsrc, logfilter *f, char **list, double speed, int rawout){
+    if(speed < 0.){
+        WARNX(_("Wrong speed factor: %g"), speed);
+        return -1;
+    }
+    routes_setup(list);
+    // without SA_RESTART: blocked write should be interrupted
+    struct sigaction sa = {.sa_handler = onstop};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    replay R = {.speed = speed, .rawout = rawout};
+    // one thread for search: records are written in order anyway
+    long long N = query_foreach(src, nsrc, f, 1, replay_record, &R);
+    long long total = 0;
+    for(int i = 0; i < nroutes; ++i){
+        route *r = &routes[i];
+        if(r->nrec) printf("%s -> %s: %" PRIu64 " records, %" PRIu64 " bytes\n", r->port, r->dest, r->nrec, r->nbytes);
+        total += r->nrec;
+        if(r->slave >= 0){ // wait while reader gets all data from pty
+            int q; // data could be not in input queue of slave yet, so sleep before check
+            do usleep(10000); while(!stop && !ioctl(r->slave, FIONREAD, &q) && q > 0);
+            close(r->slave);
+        }
+        if(r->fd >= 0) close(r->fd);
+        FREE(r->port); FREE(r->dest);
+    }
+    if(speed > 0. && total) printf("Max lateness: %.3fms\n", R.maxlate * 1e3);
+    nroutes = nports = 0;
+    return N < 0 ? -1 : total;
+}
@@ -0,0 +1,40 @@
+/*
+ * replay.h - timed replay of captured logs into pty or serial devices
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "query.h"
+
+/*
+ * Records of logs are written in time order to destinations keeping original gaps
+ * between them (divided by speed factor). Destination is "pty" (new pseudoterminal
+ * would be created & its name printed) or path to device/file. Routes are given as
+ * "port=dest" or just "dest": plain destinations are given to ports in order of
+ * their first appearance in logs; without routes each port gets its own pty.
+ */
+
+// max amount of ports replayed
+#define REPLAY_MAXPORTS     (256)
+
+long long replay_run(logsrc **src, int nsrc, logfilter *f, char **routes, double speed, int rawout);
+
+#endif // __REPLAY_H__
@@ -0,0 +1,153 @@
+/*
+ * rtsched.c - CPU affinity, real-time scheduling & memory locking
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "rtsched.h"
+#include "usefull_macros.h"
+
+static cpu_set_t cpuset;
+static int setcpus = 0, rtprio = 0, memlock = 0;
+// CPUs of ports captured by thread ("cpu" in configuration file)
+static cpu_set_t portset;
+static int setportcpus = 0;
+
+/**
+ * Parse list of CPUs like "0,2-3"
+ * @return 0 if all OK
+ */
+static int parse_cpulist(const char *str, cpu_set_t *set){
+    CPU_ZERO(set);
+    char *eptr;
+    do{
+        long a = strtol(str, &eptr, 10), b = a;
+        if(eptr == str) return 1;
+        if(*eptr == '-'){
+            str = eptr + 1;
+            b = strtol(str, &eptr, 10);
+            if(eptr == str) return 1;
+        }
+        if(a < 0 || b < a || b >= CPU_SETSIZE) return 1;
+        for(long i = a; i <= b; ++i) CPU_SET(i, set);
+        str = eptr + 1;
+    }while(*eptr == ',');
+    return *eptr ? 1 : 0;
+}
+
+/**
+ * Check & store settings of capture thread (should be called before allocations)
+ * @param cpus - list of CPUs for capture thread (like "0,2-3") or NULL
+ * @param prio - priority of SCHED_FIFO (0 - don't change scheduler)
+ * @param lock - lock all memory & prefault stack and heap
+ * @return 0 if all OK
+ */
+int rt_setup(const char *cpus, int prio, int lock){
+    if(cpus){
+        if(parse_cpulist(cpus, &cpuset)){
+            WARNX(_("Wrong list of CPUs: %s"), cpus);
+            return 1;
+        }
+        setcpus = 1;
+    }
+    if(prio){
+        int min = sched_get_priority_min(SCHED_FIFO), max = sched_get_priority_max(SCHED_FIFO);
+        if(prio < min || prio > max){
+            WARNX(_("Priority should be from %d to %d"), min, max);
+            return 1;
+        }
+        rtprio = prio;
+    }
+    if(lock){
+        // never give memory back to system & don't use mmap() for large blocks
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        memlock = 1;
+    }
+    return 0;
+}
+
+/**
+ * Check list of CPUs (of port settings)
+ * @return 0 if all OK
+ */
+int rt_checkcpus(const char *cpus){
+    cpu_set_t set;
+    return parse_cpulist(cpus, &set);
+}
+
+/**
+ * Add CPUs of port to affinity of capture thread
+ * @param cpus - list of CPUs (checked by rt_checkcpus()) or NULL to forget CPUs of all ports
+ */
+void rt_portcpus(const char *cpus){
+    if(!cpus){
+        CPU_ZERO(&portset);
+        setportcpus = 0;
+        return;
+    }
+    cpu_set_t set;
+    if(parse_cpulist(cpus, &set)) return;
+    CPU_OR(&portset, &portset, &set);
+    setportcpus = 1;
+}
+
+/**
+ * Set CPU affinity of current thread: CPUs of its ports if any of them have
+ * them, else CPUs of command line (if given); errors aren't fatal
+ */
+void rt_pin(){
+    if(setportcpus){
+        if(sched_setaffinity(0, sizeof(portset), &portset)) WARN(_("Can't set CPU affinity"));
+    }else if(setcpus && sched_setaffinity(0, sizeof(cpuset), &cpuset))
+        WARN(_("Can't set CPU affinity"));
+}
+
+// touch stack pages
+static void prefault_stack(){
+    volatile char buf[RT_STACK_PREFAULT];
+    memset((char*)buf, 0, RT_STACK_PREFAULT);
+}
+
+/**
+ * Apply settings to current thread (after all buffers allocated);
+ * errors aren't fatal
+ */
+void rt_apply(){
+    rt_pin();
+    if(memlock){
+        if(mlockall(MCL_CURRENT | MCL_FUTURE)) WARN(_("Can't lock memory"));
+        prefault_stack();
+        // heap would be kept in arena after free() as trimming is disabled
+        char *heap = malloc(RT_HEAP_PREFAULT);
+        if(heap){
+            for(size_t i = 0; i < RT_HEAP_PREFAULT; i += 4096) heap[i] = 0;
+            free(heap);
+        }
+    }
+    if(rtprio){
+        struct sched_param sp = {.sched_priority = rtprio};
+        if(sched_setscheduler(0, SCHED_FIFO, &sp)) WARN(_("Can't set SCHED_FIFO priority %d"), rtprio);
+    }
+}
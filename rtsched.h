@@ -0,0 +1,35 @@
+/*
+ * rtsched.h - CPU affinity, real-time scheduling & memory locking
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __RTSCHED_H__
+#define __RTSCHED_H__
+
+// size of stack & heap prefaulted after locking memory
+#define RT_STACK_PREFAULT   (512*1024)
+#define RT_HEAP_PREFAULT    (8*1024*1024)
+
+int rt_setup(const char *cpus, int prio, int lock);
+int rt_checkcpus(const char *cpus);
+void rt_portcpus(const char *cpus);
+void rt_pin();
+void rt_apply();
+
+#endif // __RTSCHED_H__
@@ -0,0 +1,234 @@
+/*
+ * shmtap.c - shared memory ring with records captured for external readers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "shmtap.h"
+#include "usefull_macros.h"
+
+// offset of data area in mapping
+#define DATAOFF     ((sizeof(shmtap_hdr) + 63) & ~(size_t)63)
+// full size of record in ring
+#define RECSZ(len)  ((sizeof(shmtap_rec) + (len) + 7) & ~(uint64_t)7)
+
+// writer's ring
+static shmtap_hdr *whdr = NULL;
+static char *wdata = NULL;
+static size_t wmaplen = 0;
+static char *wname = NULL;
+
+// copy data into ring / from ring (with wrapping)
+static void ring_write(char *ring, uint64_t size, uint64_t pos, const void *src, size_t len){
+    size_t off = pos & (size - 1), L = size - off;
+    if(L >= len) memcpy(ring + off, src, len);
+    else{
+        memcpy(ring + off, src, L);
+        memcpy(ring, (const char*)src + L, len - L);
+    }
+}
+static void ring_read(const char *ring, uint64_t size, uint64_t pos, void *dst, size_t len){
+    size_t off = pos & (size - 1), L = size - off;
+    if(L >= len) memcpy(dst, ring + off, len);
+    else{
+        memcpy(dst, ring + off, L);
+        memcpy((char*)dst + L, ring, len - L);
+    }
+}
+
+/**
+ * Create shared memory ring
+ * @param name - name of shm object (like "/multiterm")
+ * @param size - size of data area in bytes (would be rounded to power of 2)
+ * @param t0   - time of capture start
+ * @return 0 if all OK
+ */
+int shmtap_open(const char *name, size_t size, double t0){
+    if(whdr || !name) return 1;
+    uint64_t sz = 1<<16;
+    while(sz < size) sz <<= 1;
+    int fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0){
+        WARN(_("Can't open shared memory %s"), name);
+        return 1;
+    }
+    wmaplen = DATAOFF + sz;
+    if(ftruncate(fd, wmaplen)){
+        WARN(_("Can't set size of shared memory %s"), name);
+        close(fd);
+        return 1;
+    }
+    char *ptr = mmap(NULL, wmaplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED){
+        WARN(_("Can't mmap shared memory %s"), name);
+        shm_unlink(name);
+        return 1;
+    }
+    whdr = (shmtap_hdr*) ptr;
+    wdata = ptr + DATAOFF;
+    memset(whdr, 0, sizeof(shmtap_hdr));
+    whdr->size = sz;
+    whdr->t0 = t0;
+    __atomic_store_n(&whdr->head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&whdr->tail, 0, __ATOMIC_RELAXED);
+    memcpy(whdr->magick, SHMTAP_MAGICK, sizeof(whdr->magick)); // magick last: ring is ready
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    wname = STRDUP(name);
+    DBG("shm %s: %zd bytes", name, wmaplen);
+    return 0;
+}
+
+/**
+ * Set name of port with number `port` & encoding of its data in stdout
+ */
+void shmtap_setport(uint32_t port, const char *name, int enc){
+    if(!whdr || port >= SHMTAP_MAXPORTS) return;
+    snprintf(whdr->ports[port], SHMTAP_NAMELEN, "%s", name);
+    whdr->enc[port] = (uint8_t)enc;
+    if(whdr->nports <= port) __atomic_store_n(&whdr->nports, port + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Publish record into ring (never blocks)
+ * @param port - port number
+ * @param t    - record time
+ * @param data - payload
+ * @param len  - its length (would be truncated to 1/4 of ring)
+ */
+void shmtap_put(uint32_t port, double t, const char *data, size_t len){
+    if(!whdr) return;
+    uint64_t size = whdr->size;
+    if(RECSZ(len) > size / 4) len = size / 4 - sizeof(shmtap_rec);
+    uint64_t L = RECSZ(len), head = whdr->head, tail = whdr->tail;
+    if(head + L - tail > size){ // free space for new record moving tail
+        while(head + L - tail > size){
+            shmtap_rec r;
+            ring_read(wdata, size, tail, &r, sizeof(r));
+            tail += RECSZ(r.len);
+        }
+        __atomic_store_n(&whdr->tail, tail, __ATOMIC_RELAXED);
+        // new tail should be visible before old data overwritten
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    shmtap_rec r = {.len = (uint32_t)len, .port = port, .t = t};
+    ring_write(wdata, size, head, &r, sizeof(r));
+    ring_write(wdata, size, head + sizeof(r), data, len);
+    __atomic_store_n(&whdr->head, head + L, __ATOMIC_RELEASE);
+}
+
+/**
+ * Mark ring as closed & remove it
+ */
+void shmtap_close(){
+    if(!whdr) return;
+    __atomic_store_n(&whdr->closed, 1, __ATOMIC_RELEASE);
+    munmap(whdr, wmaplen);
+    shm_unlink(wname);
+    FREE(wname);
+    whdr = NULL; wdata = NULL;
+}
+
+// attach to ring; `quiet` - don't warn if ring isn't ready yet
+static shmtap *attach(const char *name, int quiet){
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        if(!quiet) WARN(_("Can't open shared memory %s"), name);
+        return NULL;
+    }
+    struct stat st;
+    char *ptr = MAP_FAILED;
+    if(!fstat(fd, &st) && (size_t)st.st_size > DATAOFF)
+        ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED){
+        if(!quiet) WARN(_("Can't mmap shared memory %s"), name);
+        return NULL;
+    }
+    shmtap_hdr *hdr = (shmtap_hdr*)ptr;
+    if(strncmp(hdr->magick, SHMTAP_MAGICK, sizeof(hdr->magick)) || DATAOFF + hdr->size > (size_t)st.st_size){
+        if(!quiet) WARNX(_("%s isn't a multiterm ring"), name);
+        munmap(ptr, st.st_size);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // magick is written last
+    shmtap *s = MALLOC(shmtap, 1);
+    s->hdr = hdr;
+    s->data = ptr + DATAOFF;
+    s->maplen = st.st_size;
+    s->cursor = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    return s;
+}
+
+/**
+ * Attach to ring (read-only)
+ * @param name - name of shm object
+ * @return reader structure (starting from oldest record available) or NULL
+ */
+shmtap *shmtap_attach(const char *name){
+    return attach(name, 0);
+}
+
+/**
+ * Attach to ring if it's ready (without warnings: ring could be not created yet)
+ * @param name - name of shm object
+ * @return reader structure or NULL
+ */
+shmtap *shmtap_tryattach(const char *name){
+    return attach(name, 1);
+}
+
+/**
+ * Get next record from ring
+ * @param s     - reader
+ * @param rec (o) - record header
+ * @param buf (o) - buffer for payload (it would be truncated to `bufsz`)
+ * @param bufsz - size of `buf`
+ * @return 1 if got record, 0 if there's no new records
+ */
+int shmtap_get(shmtap *s, shmtap_rec *rec, char *buf, size_t bufsz){
+    shmtap_hdr *hdr = s->hdr;
+    uint64_t size = hdr->size;
+    while(1){
+        uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if(s->cursor == head) return 0;
+        uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+        if(s->cursor < tail || s->cursor > head){ // overrun or writer restarted
+            ++s->gaps;
+            if(s->cursor < tail) s->lost += tail - s->cursor;
+            s->cursor = tail;
+            continue;
+        }
+        ring_read(s->data, size, s->cursor, rec, sizeof(shmtap_rec));
+        size_t L = rec->len;
+        if(L > size) L = 0; // broken record, it would be detected below
+        if(L > bufsz) L = bufsz;
+        ring_read(s->data, size, s->cursor + sizeof(shmtap_rec), buf, L);
+        // check that writer didn't overwrite record while we copied it
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+        if(tail > s->cursor) continue;
+        s->cursor += RECSZ(rec->len);
+        return 1;
+    }
+}
+
+void shmtap_detach(shmtap **s){
+    if(!s || !*s) return;
+    munmap((*s)->hdr, (*s)->maplen);
+    FREE(*s);
+}
@@ -0,0 +1,82 @@
+/*
+ * shmtap.h - shared memory ring with records captured for external readers
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __SHMTAP_H__
+#define __SHMTAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ring consists of header and data area with records (shmtap_rec + payload, aligned by 8).
+ * Single writer never waits for readers: before overwriting old records it moves `tail`.
+ * Reader copies record and checks `tail` again (like seqlock), so if record was
+ * overwritten while copying, reader just skips to new `tail` and increments gap counter.
+ */
+
+#define SHMTAP_MAGICK       "MTSHM01"
+// max amount of ports & length of their names
+#define SHMTAP_MAXPORTS     (256)
+#define SHMTAP_NAMELEN      (64)
+// default size of ring (MB)
+#define SHMTAP_DEFSIZE      (16)
+
+typedef struct{
+    char magick[8];     // SHMTAP_MAGICK
+    uint64_t size;      // size of data area (power of 2)
+    double t0;          // UNIX time of capture start
+    uint32_t closed;    // writer closed the ring
+    uint32_t nports;    // amount of names in `ports`
+    uint64_t head;      // amount of bytes written (position of next record)
+    uint64_t tail;      // position of oldest record available
+    char ports[SHMTAP_MAXPORTS][SHMTAP_NAMELEN]; // port names
+    uint8_t enc[SHMTAP_MAXPORTS]; // encodings of ports' data in stdout (for supervisor)
+} shmtap_hdr;
+
+typedef struct{
+    uint32_t len;       // payload length
+    uint32_t port;      // port number
+    double t;           // record time (from capture start)
+} shmtap_rec;
+
+// reader of ring
+typedef struct{
+    shmtap_hdr *hdr;    // mmaped header
+    char *data;         // data area
+    size_t maplen;      // size of mapping
+    uint64_t cursor;    // position of next record to read
+    uint64_t gaps;      // amount of overruns
+    uint64_t lost;      // amount of bytes lost
+} shmtap;
+
+// writer
+int shmtap_open(const char *name, size_t size, double t0);
+void shmtap_setport(uint32_t port, const char *name, int enc);
+void shmtap_put(uint32_t port, double t, const char *data, size_t len);
+void shmtap_close();
+
+// reader
+shmtap *shmtap_attach(const char *name);
+shmtap *shmtap_tryattach(const char *name);
+int shmtap_get(shmtap *s, shmtap_rec *rec, char *buf, size_t bufsz);
+void shmtap_detach(shmtap **s);
+
+#endif // __SHMTAP_H__
@@ -0,0 +1,311 @@
+/*
+ * supervisor.c - capture by several worker processes merged by supervisor
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <signal.h>
+#include <sys/prctl.h>      // PR_SET_PDEATHSIG
+#include <sys/wait.h>
+#include "encode.h"
+#include "hdrfmt.h"
+#include "shmtap.h"
+#include "supervisor.h"
+#include "usefull_macros.h"
+
+typedef struct{
+    pid_t pid;          // pid of worker process (0 - not running)
+    int restarts;       // amount of restarts
+    double restart;     // time when died worker should be restarted
+    char ring[64];      // name of its ring
+    shmtap *tap;        // attached ring or NULL
+    int have;           // `rec` & `buf` contain record not written yet
+    shmtap_rec rec;     // its header
+    double t;           // its UNIX time
+    char *buf;          // its payload
+    size_t bufsz;       // size of `buf`
+    char *encbuf;       // payload encoded for stdout
+    size_t encsz;       // size of `encbuf`
+    uint64_t gaps;      // amount of overruns reported
+} worker;
+
+static worker *workers = NULL;
+static int nworkers = 0;
+static sup_worker startfn = NULL;
+static FILE *comf = NULL, *outf = NULL;
+static double t0 = 0.;
+// rate limits of common log & stdout
+static tbucket comlimit, stdlimit;
+static volatile sig_atomic_t stop = 0, fwdsig = 0;
+
+static void onstop(_U_ int sig){
+    stop = 1;
+}
+// signals which should be sent to workers (SIGHUP - reload, SIGUSR2 - trigger)
+static void onfwd(int sig){
+    fwdsig = sig;
+}
+
+// fork worker process
+static void spawn(worker *w){
+    int shard = w - workers;
+    shm_unlink(w->ring); // ring of previous worker could stay after crash
+    // nothing should be flushed twice
+    if(comf) fflush(comf);
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0){
+        WARN(_("Can't fork worker %d"), shard);
+        w->restart = dtime() + SUP_RESTART;
+        return;
+    }
+    if(pid == 0){
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // don't outlive supervisor
+        if(comf) fclose(comf);
+        startfn(shard, w->ring, t0, w->restarts > 0);
+        exit(1);
+    }
+    w->pid = pid;
+    DBG("worker %d: pid %d", shard, pid);
+}
+
+// get next record of ring into worker's buffer
+static void fetch(worker *w){
+    if(w->have || !w->tap) return;
+    if(!shmtap_get(w->tap, &w->rec, w->buf, w->bufsz)) return;
+    w->have = 1;
+    w->t = w->tap->hdr->t0 + w->rec.t;
+    if(w->tap->gaps != w->gaps){
+        WARNX(_("Worker %d: %llu bytes lost (supervisor is too slow)"), (int)(w - workers),
+            (unsigned long long)w->tap->lost);
+        w->gaps = w->tap->gaps;
+    }
+}
+
+/**
+ * Check rate limit of output (and write marker of records dropped before)
+ * @return 1 if record passes
+ */
+static int limit(FILE *f, tbucket *b, double t, size_t len){
+    if(!rl_active(&b->lim)) return 1;
+    if(!tb_pass(b, t, len)) return 0;
+    if(b->dropped){
+        char buf[HDR_TIMELEN + RL_MARKERLEN + sizeof(RL_PORTNAME) + 4];
+        size_t L = hdr_common(buf, t, RL_PORTNAME, sizeof(RL_PORTNAME) - 1, 0);
+        L += tb_marker(b, buf + L);
+        buf[L++] = '\n';
+        fwrite(buf, 1, L, f);
+    }
+    return 1;
+}
+
+// write record of worker in common log format
+static void put(worker *w){
+    char hdr[HDR_TIMELEN + SHMTAP_NAMELEN + 4];
+    const char *port = w->rec.port < SHMTAP_MAXPORTS ? w->tap->hdr->ports[w->rec.port] : "?";
+    double t = w->t - t0;
+    size_t len = w->rec.len < w->bufsz ? w->rec.len : w->bufsz;
+    int addnl = !len || w->buf[len - 1] != '\n';
+    size_t L = hdr_common(hdr, t, port, strnlen(port, SHMTAP_NAMELEN - 1), addnl);
+    if(comf && limit(comf, &comlimit, t, L + len + addnl)){
+        fwrite(hdr, 1, L, comf);
+        fwrite(w->buf, 1, len, comf);
+        if(addnl) fputc('\n', comf);
+    }
+    if(outf){ // stdout gets data in encoding of port
+        const char *out = w->buf;
+        size_t outlen = len;
+        int enc = w->rec.port < SHMTAP_MAXPORTS ? w->tap->hdr->enc[w->rec.port] : 0;
+        if(enc && enc_name(enc)){ // known encoding
+            size_t need = enc_maxlen(enc, len);
+            if(need > w->encsz){
+                w->encsz = need;
+                w->encbuf = realloc(w->encbuf, need);
+                if(!w->encbuf) ERR("realloc()");
+            }
+            outlen = enc_encode(enc, w->encbuf, w->buf, len);
+            out = w->encbuf;
+            addnl = 1;
+        }
+        if(limit(outf, &stdlimit, t, L + outlen + addnl)){
+            fwrite(hdr, 1, L, outf);
+            fwrite(out, 1, outlen, outf);
+            if(addnl) fputc('\n', outf);
+        }
+    }
+    w->have = 0;
+}
+
+/**
+ * Set rate limits of common log & stdout
+ */
+void supervisor_limits(const ratelimit *common, const ratelimit *std){
+    tb_init(&comlimit, common, 0.);
+    tb_init(&stdlimit, std, 0.);
+}
+
+/**
+ * Write records of all rings in time order: record is written if all running
+ * workers have records after it or it waited SUP_WINDOW
+ * @return amount of records written
+ */
+static int merge(double now){
+    int n = 0;
+    while(1){
+        worker *best = NULL;
+        int waiting = 0;
+        for(int i = 0; i < nworkers; ++i){
+            worker *w = &workers[i];
+            fetch(w);
+            if(w->have){ if(!best || w->t < best->t) best = w; }
+            else if(w->pid) waiting = 1;
+        }
+        if(!best || (waiting && best->t > now - SUP_WINDOW)) break;
+        put(best);
+        ++n;
+    }
+    return n;
+}
+
+// attach to ring of worker
+static void attach(worker *w){
+    if(w->tap || !(w->tap = shmtap_tryattach(w->ring))) return;
+    size_t sz = w->tap->hdr->size / 4; // max record size
+    if(sz > w->bufsz){
+        FREE(w->buf);
+        w->buf = MALLOC(char, sz);
+        w->bufsz = sz;
+    }
+    w->gaps = 0;
+}
+
+// check for workers died
+static void reap(double now){
+    pid_t pid;
+    int st;
+    while((pid = waitpid(-1, &st, WNOHANG)) > 0){
+        worker *w = NULL;
+        for(int i = 0; i < nworkers && !w; ++i) if(workers[i].pid == pid) w = &workers[i];
+        if(!w) continue;
+        w->pid = 0;
+        attach(w); // it could die before we attached
+        if(stop) continue;
+        if(WIFSIGNALED(st)) WARNX(_("Worker %d (pid %d) killed by signal %d, restarting"),
+            (int)(w - workers), pid, WTERMSIG(st));
+        else WARNX(_("Worker %d (pid %d) exited with status %d, restarting"),
+            (int)(w - workers), pid, WEXITSTATUS(st));
+        w->restart = now + SUP_RESTART;
+    }
+}
+
+/**
+ * Run supervisor: fork workers & merge their records (returns after SIGINT/SIGTERM
+ * when all workers exited)
+ * @param n       - amount of workers
+ * @param start   - function starting capture in worker
+ * @param comlog  - name of common log or NULL
+ * @param trunc   - truncate common log
+ * @param quiet   - don't write records to stdout
+ * @param timefmt - format of time in headers
+ * @return 0 if all OK
+ */
+int supervisor_run(int n, sup_worker start, const char *comlog, int trunc, int quiet, int timefmt){
+    if(n < 1 || n > SUP_MAXWORKERS || !start){
+        WARNX(_("Amount of workers should be from 1 to %d"), SUP_MAXWORKERS);
+        return 1;
+    }
+    if(comlog){
+        if(!(comf = fopen(comlog, trunc ? "w" : "a"))){
+            WARN(_("Can't open %s"), comlog);
+            return 1;
+        }
+        setvbuf(comf, NULL, _IOFBF, SUP_BUFSZ);
+    }
+    if(!quiet){
+        outf = stdout;
+        setvbuf(stdout, NULL, _IOFBF, SUP_BUFSZ);
+    }
+    t0 = dtime();
+    hdr_setup(timefmt, t0);
+    struct sigaction sa = {.sa_handler = onstop};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+    sa.sa_handler = onfwd;
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    nworkers = n;
+    startfn = start;
+    workers = MALLOC(worker, n);
+    for(int i = 0; i < n; ++i){
+        snprintf(workers[i].ring, sizeof(workers[i].ring), "/multiterm.%d.%d", (int)getpid(), i);
+        spawn(&workers[i]);
+    }
+    int killed = 0;
+    while(1){
+        double now = dtime();
+        if(fwdsig){
+            int sig = fwdsig;
+            fwdsig = 0;
+            for(int i = 0; i < n; ++i) if(workers[i].pid) kill(workers[i].pid, sig);
+        }
+        if(stop && !killed){
+            for(int i = 0; i < n; ++i) if(workers[i].pid) kill(workers[i].pid, SIGTERM);
+            killed = 1;
+        }
+        reap(now);
+        int alive = 0;
+        for(int i = 0; i < n; ++i){
+            worker *w = &workers[i];
+            if(w->pid) attach(w);
+            else if(w->tap && !w->have){ // records of died worker could stay in ring
+                fetch(w);
+                if(!w->have){ // all read
+                    shmtap_detach(&w->tap);
+                    w->tap = NULL;
+                    shm_unlink(w->ring);
+                }
+            }else if(!w->tap && !stop && now >= w->restart){
+                ++w->restarts;
+                spawn(w);
+            }
+            if(w->pid || w->tap) alive = 1;
+        }
+        int nrec = merge(now);
+        if(nrec){
+            if(comf) fflush(comf);
+            if(outf) fflush(outf);
+        }
+        if(stop && !alive) break;
+        if(!nrec) usleep(SUP_POLL);
+    }
+    for(int i = 0; i < n; ++i){
+        if(workers[i].restarts) green(_("Worker %d was restarted %d times\n"), i, workers[i].restarts);
+        FREE(workers[i].buf);
+        FREE(workers[i].encbuf);
+    }
+    if(stdlimit.total)
+        WARNX(_("%llu records (%llu bytes) weren't written to stdout by rate limit"),
+            (unsigned long long)stdlimit.total, (unsigned long long)stdlimit.totalbytes);
+    if(comlimit.total)
+        WARNX(_("%llu records (%llu bytes) weren't written to common log by rate limit"),
+            (unsigned long long)comlimit.total, (unsigned long long)comlimit.totalbytes);
+    FREE(workers);
+    if(comf) fclose(comf);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * supervisor.h - capture by several worker processes merged by supervisor
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __SUPERVISOR_H__
+#define __SUPERVISOR_H__
+
+#include "ratelim.h"
+
+/*
+ * Supervisor forks workers, each of them captures its shard of ports as usual
+ * (per-port logs, decoders etc) and publishes records into own shared memory
+ * ring "/multiterm.<pid>.<shard>". Supervisor merges records of all rings by
+ * time into common log & stdout (with encodings of ports & rate limits of
+ * these outputs). Died worker is restarted (after its ring
+ * is read to the end), other workers continue capture.
+ */
+
+// max amount of workers
+#define SUP_MAXWORKERS  (64)
+// max time records wait for older records of other workers (s)
+#define SUP_WINDOW      (0.1)
+// pause before restart of died worker (s)
+#define SUP_RESTART     (1.)
+// period of polling rings when they're empty (us)
+#define SUP_POLL        (2000)
+// size of output buffers
+#define SUP_BUFSZ       (1<<20)
+
+// function starting capture in worker process (shouldn't return)
+typedef void (*sup_worker)(int shard, const char *ring, double t0, int restarted);
+
+void supervisor_limits(const ratelimit *common, const ratelimit *std);
+int supervisor_run(int nworkers, sup_worker start, const char *comlog, int trunc, int quiet, int timefmt);
+
+#endif // __SUPERVISOR_H__
@@ -18,8 +18,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
  * MA 02110-1301, USA.
  */
+#define _GNU_SOURCE         // O_DIRECT
 #include <unistd.h>         // tcsetattr, close, read, write
 #include <sys/ioctl.h>      // ioctl
+#include <linux/serial.h>   // serial_icounter_struct
+#include <sys/epoll.h>      // epoll
 #include <stdio.h>          // printf, getchar, fopen, perror
 #include <stdlib.h>         // exit
 #include <sys/stat.h>       // read
@@ -29,29 +32,133 @@
 #include <string.h>         // memcpy
 #include <stdint.h>         // int types
 #include <sys/time.h>       // gettimeofday
+#include <float.h>          // DBL_MAX
 #include <unistd.h>         // usleep
-//#include <pthread.h>
+#include <pthread.h>
+#include <sys/eventfd.h>    // eventfd
+#include <poll.h>           // poll
 
 #include "term.h"
+#include "config.h"
+#include "decode.h"
+#include "durable.h"
+#include "encode.h"
+#include "flight.h"
+#include "hdrfmt.h"
+#include "logfile.h"
+#include "match.h"
+#include "netsrv.h"
+#include "probes.h"
+#include "ratelim.h"
+#include "rtsched.h"
+#include "shmtap.h"
+#include "timing.h"
 #include "usefull_macros.h"
 
-#define LOGBUFSZ (1024)
+// size of buffer for single read()
+#define RDBUFSZ  (4096)
+// size of buffer for record header
+#define HDRBUFSZ (256)
+// size of buffer for data waiting forwarding in passthrough mode
+#define FWDBUFSZ (65536)
+// max amount of events got by one epoll_wait()
+#define MAXEVENTS (64)
+// tag of socket server's events (others are numbers of port descriptors)
+#define EVTAG_NET (1ULL << 32)
+// tag of eventfd of ports' initialization
+#define EVTAG_INIT (1ULL << 33)
+// outputs of record: per-port log & shared ones (common log, stdout, socket, shared memory)
+#define OUT_LOG     (1)
+#define OUT_SHARED  (2)
+// timing file opened: header or resync entry should be written
+#define TIM_NEW     (1)
+#define TIM_RESYNC  (2)
 
 typedef struct {
     int speed;  // communication speed in bauds/s
     int bspeed; // baudrate from termios.h
 } spdtbl;
 
+// statistics of forwarding in passthrough mode
+typedef struct {
+    uint64_t chunks;        // amount of data chunks forwarded
+    uint64_t bytes;         // amount of bytes forwarded
+    uint64_t dropped;       // amount of bytes dropped (peer didn't read them)
+    double sumlat;          // sum of latencies (from read to write)
+    double maxlat;          // max latency
+} fwdstat;
+
+// output with batching of records
+typedef struct {
+    int fd;                 // file descriptor (0 - not opened)
+    char *buf;              // data waiting for writing
+    size_t size;            // size of `buf`
+    size_t len;             // length of data
+    size_t done;            // amount of data in `buf` already written (O_DIRECT)
+    uint64_t fileoff;       // file offset of `buf` start
+    int direct;             // file opened with O_DIRECT
+    int durid;              // id of file in sync thread (0 - not synced)
+    double deadline;        // time (from start) when data should be written
+    int lossy;              // non-blocking output: records are dropped if buffer is full
+    int blocked;            // lossy output can't be written now
+    uint64_t dropped;       // amount of records dropped
+    uint64_t droppedbytes;  // and their size
+    tbucket *limit;         // rate limit of records (NULL - no limit)
+} outsink;
+
 typedef struct {
     char *portname;         // device filename (should be freed before structure freeing)
+    size_t namelen;         // its length in headers
     int baudrate;           // baudrate (B...)
+    tcflag_t cflag;         // data bits, parity & stop bits (CSx|PARENB|PARODD|CSTOPB)
+    char *logname;          // name of log file or NULL for default
+    char *cpus;             // CPUs of capture thread given for port or NULL
     struct termio oldtty;   // TTY flags for previous port settings
     struct termio tty;      // TTY flags for current settings
     int comfd;              // TTY file descriptor
-    int logfd;              // log file descriptor
-    char logbuf[LOGBUFSZ];  // buffer for data readed
+    int disconnected;       // port was disconnected (would be reopened on reload)
+    outsink log;            // log file
+    int idxfd;              // index file descriptor (or -1)
+    uint64_t logoff;        // amount of bytes written to log
+    uint32_t nrec;          // amount of records written to log
+    char *logbuf;           // buffer for data readed
+    int bufsz;              // its size
     int logbuflen;          // length of data in logbuf
+    int charmode;           // character mode instead of lines
+    double latency;         // max time of data waiting in buffers (s)
+    double tfirst;          // time of first byte in logbuf
     char linerdy;           // flag of getting '\n' in input data
+    int fwdfd;              // passthrough: fd to forward data readed (or -1)
+    int peer;               // passthrough: index of descriptor of opposite direction
+    int ptyslave;           // slave side of pty (kept opened) or 0 for real port
+    char *fwdbuf;           // passthrough: data which peer can't get yet
+    size_t fwdlen;          // its length
+    double fwdt;            // time when first byte in `fwdbuf` was read
+    fwdstat stat;           // statistics of forwarding
+    int timing;             // write times of chunks read into timing file
+    outsink tim;            // timing file
+    uint32_t charns;        // transmission time of single character, ns
+    uint64_t timprev;       // time of previous entry of timing file from start, us
+    int timnew;             // timing file is opened, but its header (TIM_NEW) or resync entry (TIM_RESYNC) isn't written yet
+    uint64_t chunkprev;     // time of previous chunk from start, us
+    timhist hist;           // histogram of gaps between chunks
+    decoder *dec;           // protocol decoder
+    int encoding;           // encoding of data in stdout & socket outputs
+    char *encbuf;           // buffer for encoded data
+    outsink decsink;        // file with summaries of decoded frames
+    flring *ring;           // flight recorder: last records of port
+    uint32_t mstate;        // state of patterns matcher
+    uint64_t *matches;      // amount of matches of each pattern
+    int nerrors;            // framing & parity errors counted before
+    double dedup;           // max time of collapsing repeated records (s), 0 - don't collapse
+    char *dupbuf;           // previous record (size of buffer is `bufsz`)
+    int duplen;             // its length (-1 - nothing to compare with)
+    uint64_t duphash;       // its hash
+    uint64_t loghash;       // hash of record in `logbuf` (counted by dedup_check())
+    uint64_t dupn;          // amount of its repeats collapsed
+    double dupt0;           // time of previous record
+    double dupt;            // time of its last repeat
+    tbucket limit;          // rate limit of records (no limit if `limit.lim` is empty)
     //pthread_t thread;       // thread identificator for kill/join
 } TTY_descr;
 
@@ -61,34 +168,276 @@ typedef struct {
 static TTY_descr *descriptors = NULL;
 // amount of opened descriptors
 static int descr_amount = 0;
-// common log fd
-static int common_fd = 0;
-// max value of comfd - for select()
-static int maxfd = 0;
+// common log & stdout
+static outsink comsink = {0}, stdsink = {.fd = 1, .lossy = 1, .size = STDQ_DEFSIZE};
+// rate limits of common log & stdout
+static tbucket comlimit, stdlimit;
+// flags of stdout to restore at exit
+static int stdflags = -1;
+// open per-port logs with O_DIRECT
+static int directio = 0;
+// max amount of bytes batched in outputs
+static size_t flushbytes = FLUSH_DEFBYTES;
+// nearest time when some data should be written
+static double next_flush = DBL_MAX;
+// epoll fd for ports & clients
+static int epollfd = -1;
+// passthrough mode: own ports & forward data between them and pty
+static int passthrough = 0;
 // name of common log file
 static char *commonlogname = NULL;
-// time of start
+// time of start (if it's not set before ttys_open())
 static double t0 = -10.;
-// character mode
-static int charmode = 0;
+// open existing logs for appending (restarted worker of supervisor mode)
+static int appendlogs = 0;
+// records between index entries (0 - don't create index)
+static uint32_t idxstep = IDX_DEFSTEP;
+// format of time in headers of records
+static int timefmt = TIME_REL;
+// name of shared memory ring & its size
+static char *shmname = NULL;
+static size_t shmsize = 0;
+// address of socket for live viewers
+static char *listenaddr = NULL;
+// reload of configuration requested (by SIGHUP)
+static volatile sig_atomic_t reload = 0;
+// function to get new ports' settings on reload
+static portcfg *(*getports)(int *nports) = NULL;
+
+// flight recorder mode: size of ports' rings (0 - off), time of records kept (s, 0 - all)
+// and time of logging after trigger (s)
+static size_t flightsize = 0;
+static double flightkeep = 0., flightpost = FLIGHT_DEFPOST;
+// records are written into logs till this time (from start)
+static double flight_until = -1.;
+// patterns matched in data of ports: patterns from `firsttrig` trigger dump
+static matcher *patterns = NULL;
+static int firsttrig = 0;
+// log of matches, its name & print matches on stdout
+static outsink evsink = {0};
+static char *evlogname = NULL;
+static int matchcolor = 0;
+// amount of framing & parity errors which triggers dump (0 - don't check)
+static int trigerrors = 0;
+// time of last check of errors counters
+static double errcheck_t = 0.;
+// dump requested by SIGUSR2
+static volatile sig_atomic_t usrtrigger = 0;
+
+// states of ports opened at start
+enum{
+    PINIT_WAIT,         // is being opened
+    PINIT_READY,        // opened, waiting start
+    PINIT_FAIL,         // can't be opened
+    PINIT_STARTED       // captured
+};
+// ports opened at start by pool of threads: each port is set up in its own copy
+// of descriptors and is started by capture thread as soon as it's ready
+typedef struct{
+    portcfg *ports;     // settings of ports
+    int nports;         // their amount
+    int next;           // next port to open
+    int started;        // amount of ports started
+    int *state;         // states of ports
+    double *tinit;      // time of ports' initialization (s)
+    TTY_descr *descr;   // descriptors being set up
+    pthread_t *threads; // pool (NULL when all ports are started)
+    int nthreads;       // its size
+    int evfd;           // eventfd: some port is ready
+    double tstart;      // time when pool started
+} portinit;
+static portinit pinit = {.evfd = -1};
+static int initthreads = INIT_DEFTHREADS;
 
 // in cmdlnopts.c
 extern int rewrite_ifexists;
 
 static int tty_init(TTY_descr *descr);
 static void restore_ttys();
-static void write_logblocks(char force);
+static void write_record(TTY_descr *d, double twr);
+static void dedup_flush(TTY_descr *d);
+static void limit_flush(TTY_descr *d, double t);
+static void ports_ready();
+static void init_abort();
+static void log_record(TTY_descr *d, double twr, const char *data, size_t len, int addnl, double deadline, int outs);
 
 /**
  * change value of common log filename
  */
 void set_comlogname(char* nm){
     FREE(commonlogname);
-    commonlogname = strdup(nm);
+    commonlogname = STRDUP(nm);
+}
+
+/**
+ * set function which gives new settings of ports on reload
+ * (if not set, reload only reopens log files)
+ */
+void set_portsgetter(portcfg *(*fn)(int *nports)){
+    getports = fn;
+}
+
+/**
+ * SIGHUP handler: reload configuration in main loop
+ */
+void term_reload(_U_ int sig){
+    reload = 1;
 }
 
-void set_charmode(){
-    charmode = 1;
+/**
+ * SIGUSR2 handler: trigger of flight recorder
+ */
+void term_trigger(_U_ int sig){
+    usrtrigger = 1;
+}
+
+/**
+ * Turn on flight recorder mode: records are kept in RAM rings & written into
+ * logs only after trigger
+ * @param sizemb - size of each port's ring, MB
+ * @param keep   - max age of records dumped (s), 0 - all records in ring
+ * @param post   - time of logging after trigger (s)
+ */
+void set_flight(int sizemb, int keep, int post){
+    if(sizemb < 1 || keep < 0 || post < 0) ERRX(_("Wrong flight recorder settings"));
+    flightsize = (size_t)sizemb << 20;
+    flightkeep = keep;
+    flightpost = post;
+}
+
+/**
+ * Set patterns searched in data of all ports
+ * @param match   - NULL-terminated list of patterns which are just counted & logged
+ * @param trigger - NULL-terminated list of patterns which also trigger flight recorder
+ */
+void set_patterns(char **match, char **trigger){
+    int nm = 0, nt = 0;
+    if(match) while(match[nm]) ++nm;
+    if(trigger) while(trigger[nt]) ++nt;
+    if(!nm && !nt) return;
+    char **all = MALLOC(char*, nm + nt);
+    for(int i = 0; i < nm; ++i) all[i] = match[i];
+    for(int i = 0; i < nt; ++i) all[nm + i] = trigger[i];
+    match_free(&patterns);
+    if(!(patterns = match_compile(all, nm + nt))) ERRX(_("Wrong patterns"));
+    firsttrig = nm;
+    FREE(all);
+}
+
+/**
+ * set name of log file for matches of patterns
+ */
+void set_matchlog(char *name){
+    FREE(evlogname);
+    evlogname = STRDUP(name);
+}
+
+/**
+ * print matches of patterns on stdout
+ */
+void set_matchcolor(){
+    matchcolor = 1;
+}
+
+/**
+ * set amount of framing/parity errors on port which triggers flight recorder dump
+ */
+void set_trigerrors(int n){
+    if(n < 0) ERRX(_("Wrong amount of errors: %d"), n);
+    trigerrors = n;
+}
+
+/**
+ * Set time of capture start (workers of supervisor mode have common start
+ * time) & open existing logs for appending if `append` is set
+ */
+void set_starttime(double t, int append){
+    t0 = t;
+    appendlogs = append;
+}
+
+/**
+ * set max amount of bytes batched in each output
+ */
+void set_flushbytes(int bytes){
+    if(bytes < FLUSH_MINBYTES) ERRX(_("Flush buffer should be not less than %d bytes"), FLUSH_MINBYTES);
+    flushbytes = ((size_t)bytes + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+}
+
+/**
+ * Set rate limits of common log & stdout (records over limits are dropped
+ * with markers "rate limit: N records dropped")
+ */
+void set_sinklimits(const ratelimit *common, const ratelimit *std){
+    if(common && rl_active(common)){
+        tb_init(&comlimit, common, 0.);
+        comsink.limit = &comlimit;
+    }
+    if(std && rl_active(std)){
+        tb_init(&stdlimit, std, 0.);
+        stdsink.limit = &stdlimit;
+    }
+}
+
+/**
+ * set size of stdout queue (0 - don't write records to stdout)
+ */
+void set_stdqueue(int kbytes){
+    if(kbytes < 0) ERRX(_("Wrong size of stdout queue: %d"), kbytes);
+    if(kbytes == 0) stdsink.fd = -1;
+    stdsink.size = (size_t)kbytes << 10;
+}
+
+/**
+ * open per-port logs with O_DIRECT
+ */
+void set_directio(){
+    directio = 1;
+}
+
+void set_passthrough(){
+    passthrough = 1;
+}
+
+/**
+ * set name & size (in megabytes) of shared memory ring for external readers
+ */
+void set_shmname(char *nm, int sizemb){
+    if(sizemb < 1) ERRX(_("Wrong size of shared memory ring: %d"), sizemb);
+    FREE(shmname);
+    shmname = STRDUP(nm);
+    shmsize = (size_t)sizemb << 20;
+}
+
+/**
+ * set address (UNIX socket path or [host]:port) for live viewers
+ */
+void set_listenaddr(char *addr){
+    FREE(listenaddr);
+    listenaddr = STRDUP(addr);
+}
+
+/**
+ * set format of time in headers of records (timeformat from hdrfmt.h)
+ */
+void set_timeformat(int format){
+    timefmt = format;
+}
+
+/**
+ * set amount of records between log index entries (0 to disable index)
+ */
+void set_idxstep(int step){
+    if(step < 0) ERRX(_("Wrong index step: %d"), step);
+    idxstep = (uint32_t)step;
+}
+
+/**
+ * Set amount of threads opening ports at start
+ */
+void set_initthreads(int n){
+    if(n < 1) ERRX(_("Wrong amount of threads: %d"), n);
+    initthreads = n;
 }
 
 //sed 's/[^ ]* *B\([^ ]*\).*/    {\1, B\1},/g'
@@ -160,10 +509,9 @@ static spdtbl speeds[] = {
 
 /**
  * test if `speed` is in .speed of `speeds` array
- * if not, exit with error code
- * if all OK, return `Bxxx` speed for given baudrate
+ * @return `Bxxx` speed for given baudrate or 0 if it's wrong
  */
-int conv_spd(int speed){
+int get_bspeed(int speed){
     spdtbl *spd = speeds;
     int curspeed = 0;
     do{
@@ -172,74 +520,426 @@ int conv_spd(int speed){
             return spd->bspeed;
         ++spd;
     }while(curspeed);
-    ERRX(_("Wrong speed value: %d!"), speed);
     return 0;
 }
 
+/**
+ * test if `speed` is in .speed of `speeds` array
+ * if not, exit with error code
+ * if all OK, return `Bxxx` speed for given baudrate
+ */
+int conv_spd(int speed){
+    int bspeed = get_bspeed(speed);
+    if(!bspeed) ERRX(_("Wrong speed value: %d!"), speed);
+    return bspeed;
+}
+
+/**
+ * Convert framing string like "8N1" or "7E2" into termios flags
+ * @param framing - data bits (5..8), parity (N, E or O) & stop bits (1 or 2)
+ * @param cflag (o) - flags (may be NULL to check string)
+ * @return 0 if all OK
+ */
+int framing2cflag(const char *framing, tcflag_t *cflag){
+    static const tcflag_t csize[] = {CS5, CS6, CS7, CS8};
+    if(!framing || strlen(framing) != 3) return 1;
+    tcflag_t f;
+    if(framing[0] < '5' || framing[0] > '8') return 1;
+    f = csize[framing[0] - '5'];
+    switch(framing[1]){
+        case 'N': case 'n': break;
+        case 'E': case 'e': f |= PARENB; break;
+        case 'O': case 'o': f |= PARENB | PARODD; break;
+        default: return 1;
+    }
+    if(framing[2] == '2') f |= CSTOPB;
+    else if(framing[2] != '1') return 1;
+    if(cflag) *cflag = f;
+    return 0;
+}
+
+/**
+ * Transmission time of single character (start bit, data, parity & stop bits)
+ * @param speed - baudrate
+ * @param cflag - framing flags
+ * @return time in ns
+ */
+static uint32_t char_ns(int speed, tcflag_t cflag){
+    static const int csize[] = {[CS5] = 5, [CS6] = 6, [CS7] = 7, [CS8] = 8};
+    int bits = 1 + csize[cflag & CSIZE] + ((cflag & PARENB) ? 1 : 0) + ((cflag & CSTOPB) ? 2 : 1);
+    return speed > 0 ? (uint32_t)(1e9 * bits / speed) : 0;
+}
+
 /**
  * Exit & return terminal to old state
  * @param ex_stat - status (return code)
  */
 void term_quit(int ex_stat){
+    mem_steady(0);
+    init_abort(); // ports being opened at start
     restore_ttys();
+    size_t nalloc = mem_steady_allocs();
+    if(nalloc) WARNX(_("%zd memory allocations during capture"), nalloc);
+    nalloc = mem_pool_fallbacks();
+    if(nalloc) WARNX(_("%zd blocks allocated outside of pools"), nalloc);
     WARNX("Exit! (%d)\n", ex_stat);
     exit(ex_stat);
 }
 
 /**
- * Open & setup terminal
+ * Open (if not opened yet) & setup terminal
  * @param descr (io) - port descriptor
  * @return 0 if all OK
  */
 static int tty_init(TTY_descr *descr){
-    DBG("\nOpen port...");
-    if ((descr->comfd = open(descr->portname, O_RDONLY|O_NOCTTY|O_NONBLOCK)) < 0){
-        WARN(_("Can't use port %s"), descr->portname);
-        return globErr ? globErr : 1;
-    }
-    DBG("OK\nGet current settings...");
-    if(ioctl(descr->comfd, TCGETA, &descr->oldtty) < 0){ // Get settings
-        WARN(_("Can't get old TTY settings"));
-        return globErr ? globErr : 1;
+    if(descr->comfd <= 0){
+        DBG("\nOpen port...");
+        int oflag = (passthrough ? O_RDWR : O_RDONLY) | O_NOCTTY | O_NONBLOCK;
+        if ((descr->comfd = open(descr->portname, oflag)) < 0){
+            WARN(_("Can't use port %s"), descr->portname);
+            return globErr ? globErr : 1;
+        }
+        DBG("OK\nGet current settings...");
+        if(ioctl(descr->comfd, TCGETA, &descr->oldtty) < 0){ // Get settings
+            WARN(_("Can't get old TTY settings"));
+            return globErr ? globErr : 1;
+        }
     }
     descr->tty = descr->oldtty;
     struct termio  *tty = &descr->tty;
     tty->c_lflag     = 0; // ~(ICANON | ECHO | ECHOE | ISIG)
     tty->c_oflag     = 0;
-    tty->c_cflag     = descr->baudrate|CS8|CREAD|CLOCAL; // 9.6k, 8N1, RW, ignore line ctrl
+    tty->c_cflag     = descr->baudrate|descr->cflag|CREAD|CLOCAL; // speed, framing, RW, ignore line ctrl
     tty->c_cc[VMIN]  = 0;  // non-canonical mode
     tty->c_cc[VTIME] = 5;
     if(ioctl(descr->comfd, TCSETA, &descr->tty) < 0){
         WARN(_("Can't apply new TTY settings"));
         return globErr ? globErr : 1;
     }
-    if(descr->comfd >= maxfd) maxfd = descr->comfd + 1;
     DBG("OK");
     return 0;
 }
 
+/**
+ * write all `len` bytes of `buf` (at `offset` if it isn't negative)
+ * @return amount of bytes written (less than `len` in case of error, see errno)
+ */
+static size_t write_all(int fd, const char *buf, size_t len, off_t offset){
+    size_t done = 0;
+    while(done < len){
+        ssize_t w = offset < 0 ? write(fd, buf + done, len - done) : pwrite(fd, buf + done, len - done, offset + done);
+        PROBE3(sink_write, fd, len - done, w);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            break;
+        }
+        done += w;
+    }
+    return done;
+}
+
+/**
+ * Write data of non-blocking output: rest of data stays in buffer, next
+ * try would be made after SINK_RETRY seconds
+ */
+static void lossy_flush(outsink *s){
+    double now = dtime() - t0;
+    if(s->blocked && now < s->deadline) return;
+    size_t w = write_all(s->fd, s->buf, s->len, -1);
+    if(w < s->len && errno != EAGAIN){
+        WARN(_("Can't write to stdout, disable it"));
+        s->fd = -1;
+        s->len = 0;
+        return;
+    }
+    s->len -= w;
+    memmove(s->buf, s->buf + w, s->len);
+    if((s->blocked = (s->len > 0))){
+        s->deadline = now + SINK_RETRY;
+        if(s->deadline < next_flush) next_flush = s->deadline;
+    }
+}
+
+/**
+ * Last flush of lossy output (at exit): wait for it no more than SINK_FINALWAIT
+ * seconds, data which can't be written is counted as dropped
+ */
+static void lossy_final(outsink *s){
+    double tend = dtime() + SINK_FINALWAIT;
+    while(s->fd > 0 && s->len){
+        s->blocked = 0;
+        lossy_flush(s);
+        double rest = tend - dtime();
+        if(!s->len || rest <= 0.) break;
+        struct pollfd pfd = {.fd = s->fd, .events = POLLOUT};
+        poll(&pfd, 1, (int)(rest * 1e3) + 1);
+    }
+    if(s->len){ // (part of) record at least
+        ++s->dropped;
+        s->droppedbytes += s->len;
+        s->len = 0;
+    }
+}
+
+/**
+ * Lossy output: check if record with size `len` fits into buffer, else count it as dropped
+ * @return 1 if record can be put into output
+ */
+static int sink_room(outsink *s, size_t len){
+    if(s->fd < 1) return 0;
+    if(s->size - s->len >= len) return 1;
+    lossy_flush(s);
+    if(s->size - s->len >= len) return 1;
+    ++s->dropped;
+    s->droppedbytes += len;
+    return 0;
+}
+
+/**
+ * Write all data of output
+ * O_DIRECT output writes full blocks directly and the rest through page cache;
+ * this rest stays in buffer to be rewritten with next data
+ */
+static void sink_flush(outsink *s){
+    if(s->len == s->done) return;
+    PROBE2(sink_flush, s->fd, s->len - s->done);
+    if(s->lossy) lossy_flush(s);
+    else if(!s->direct){
+        write_all(s->fd, s->buf, s->len, -1);
+        s->fileoff += s->len;
+        s->len = 0;
+    }else{
+        size_t full = s->len & ~(size_t)(DIRECT_ALIGN - 1), tail = s->len - full;
+        if(full) write_all(s->fd, s->buf, full, s->fileoff);
+        if(tail){
+            int fl = fcntl(s->fd, F_GETFL);
+            fcntl(s->fd, F_SETFL, fl & ~O_DIRECT);
+            write_all(s->fd, s->buf + full, tail, s->fileoff + full);
+            fcntl(s->fd, F_SETFL, fl);
+            memmove(s->buf, s->buf + full, tail);
+        }
+        s->fileoff += full;
+        s->len = s->done = tail;
+    }
+    durable_setoff(s->durid, s->fileoff + s->done);
+}
+
+/**
+ * Add data to output
+ * @param s        - output
+ * @param data     - data
+ * @param len      - its length
+ * @param deadline - time when data should be written
+ */
+static void sink_put(outsink *s, const char *data, size_t len, double deadline){
+    if(s->fd < 1) return;
+    if(s->len == s->done || deadline < s->deadline) s->deadline = deadline;
+    if(deadline < next_flush) next_flush = deadline;
+    while(len){
+        size_t n = s->size - s->len;
+        if(n > len) n = len;
+        memcpy(s->buf + s->len, data, n);
+        s->len += n;
+        data += n; len -= n;
+        if(s->len == s->size) sink_flush(s);
+    }
+}
+
+// flush output if its deadline came or update nearest deadline
+static void sink_check(outsink *s, double now){
+    if(s->len == s->done) return;
+    if(s->deadline <= now) sink_flush(s);
+    else if(s->deadline < next_flush) next_flush = s->deadline;
+}
+
+/**
+ * Check rate limit of shared output (common log or stdout) for record; marker
+ * about records dropped before is written into output before record passed
+ * @param s   - output
+ * @param t   - time of record
+ * @param len - its size
+ * @return 1 if record should be written
+ */
+static int sink_limit(outsink *s, double t, size_t len){
+    if(!s->limit) return 1;
+    if(!tb_pass(s->limit, t, len)) return 0;
+    if(s->limit->dropped && (!s->lossy || sink_room(s, HDRBUFSZ + RL_MARKERLEN))){
+        char buf[HDRBUFSZ + RL_MARKERLEN];
+        size_t L = hdr_common(buf, t, RL_PORTNAME, sizeof(RL_PORTNAME) - 1, 0);
+        L += tb_marker(s->limit, buf + L);
+        buf[L++] = '\n';
+        sink_put(s, buf, L, t);
+    }
+    return 1;
+}
+
+/**
+ * Set length of port name in headers (long names are truncated)
+ */
+static void set_namelen(TTY_descr *d){
+    d->namelen = strlen(d->portname);
+    if(d->namelen > HDRBUFSZ - HDR_TIMELEN - 3) d->namelen = HDRBUFSZ - HDR_TIMELEN - 3;
+}
+
+/**
+ * Set encoding of port's data in stdout & socket outputs (buffer is allocated
+ * for current size of line buffer)
+ */
+static void set_encoding(TTY_descr *d, int enc){
+    FREE(d->encbuf);
+    d->encoding = enc;
+    if(enc != ENC_RAW) d->encbuf = MALLOC(char, enc_maxlen(enc, d->bufsz));
+}
+
+/**
+ * Set max time of collapsing repeated records (0 - don't collapse); buffer of
+ * previous record is allocated for current size of line buffer
+ */
+static void set_dedup(TTY_descr *d, double dedup){
+    dedup_flush(d);
+    FREE(d->dupbuf);
+    d->dedup = dedup;
+    d->duplen = -1;
+    if(dedup > 0.) d->dupbuf = MALLOC(char, d->bufsz);
+}
+
+/**
+ * Write summary of decoded frame into decoder's file & stdout
+ * @param t       - time of frame
+ * @param summary - its summary
+ * @param len     - length of summary
+ * @param arg     - port descriptor
+ */
+static void on_decoded(double t, const char *summary, size_t len, void *arg){
+    TTY_descr *d = (TTY_descr*)arg;
+    char hdr[HDRBUFSZ + PATH_MAX];
+    double deadline = t + d->latency;
+    size_t L = hdr_port(hdr, t, 0);
+    sink_put(&d->decsink, hdr, L, deadline);
+    sink_put(&d->decsink, summary, len, deadline);
+    sink_put(&d->decsink, "\n", 1, deadline);
+    L = hdr_time(hdr, t);
+    L += snprintf(hdr + L, sizeof(hdr) - L, ": %s [%s]\n", d->portname, d->dec->ops->name);
+    if(L >= sizeof(hdr)) L = sizeof(hdr) - 1;
+    if(sink_limit(&stdsink, t, L + len + 1) && sink_room(&stdsink, L + len + 1)){
+        sink_put(&stdsink, hdr, L, deadline);
+        sink_put(&stdsink, summary, len, deadline);
+        sink_put(&stdsink, "\n", 1, deadline);
+    }
+    if(d->latency <= 0.){ // exact mode
+        sink_flush(&d->decsink);
+        sink_flush(&stdsink);
+    }
+}
+
+/**
+ * Write pending frame of decoder, print its counters & remove it
+ */
+static void close_decoder(TTY_descr *d){
+    if(!d->dec) return;
+    decoder_idle(d->dec, DBL_MAX, on_decoded, d);
+    if(d->dec->frames || d->dec->errors)
+        green(_("%s: %llu %s frames, %llu errors\n"), d->portname, (unsigned long long)d->dec->frames,
+            d->dec->ops->name, (unsigned long long)d->dec->errors);
+    decoder_free(&d->dec);
+}
+
+/**
+ * Write rest of data, restore port to previous state, close its files
+ * and free memory occupied by descriptor
+ */
+static void close_port(TTY_descr *d){
+    DBG("close %s", d->portname);
+    if(d->logbuflen) write_record(d, dtime() - t0); // write rest of data
+    dedup_flush(d);
+    limit_flush(d, dtime() - t0);
+    close_decoder(d);
+    sink_flush(&d->decsink);
+    if(d->decsink.fd > 0) close(d->decsink.fd);
+    sink_flush(&d->log);
+    fwdstat *s = &d->stat;
+    if(s->chunks) green(_("%s: forwarded %llu bytes (%llu dropped), latency mean %.1fus, max %.1fus\n"),
+            d->portname, (unsigned long long)s->bytes, (unsigned long long)s->dropped,
+            s->sumlat / s->chunks * 1e6, s->maxlat * 1e6);
+    if(d->limit.total) green(_("%s: %llu records (%llu bytes) dropped by rate limit\n"), d->portname,
+            (unsigned long long)d->limit.total, (unsigned long long)d->limit.totalbytes);
+    if(d->matches) for(int i = 0; i < patterns->npatterns; ++i)
+        if(d->matches[i]) green(_("%s: %llu matches of \"%s\"\n"), d->portname,
+            (unsigned long long)d->matches[i], patterns->names[i]);
+    if(d->comfd > 0){
+        if(epollfd > -1 && !d->disconnected) epoll_ctl(epollfd, EPOLL_CTL_DEL, d->comfd, NULL);
+        if(d->ptyslave > 0) close(d->ptyslave); // pty of passthrough mode
+        else ioctl(d->comfd, TCSETA, &d->oldtty); // return TTY to previous state
+        close(d->comfd);
+    }
+    durable_del(d->log.durid);
+    if(d->log.fd > 0)
+        close(d->log.fd);
+    if(d->idxfd > 0)
+        close(d->idxfd);
+    sink_flush(&d->tim);
+    if(d->tim.fd > 0) close(d->tim.fd);
+    if(d->hist.nchunks){
+        green(_("%s: idle gaps between chunks\n"), d->portname);
+        tim_histprint(&d->hist, stdout);
+    }
+    FREE(d->portname);
+    FREE(d->logname);
+    FREE(d->cpus);
+    FREE(d->logbuf);
+    FREE(d->fwdbuf);
+    FREE(d->log.buf);
+    FREE(d->tim.buf);
+    FREE(d->decsink.buf);
+    FREE(d->encbuf);
+    FREE(d->dupbuf);
+    FREE(d->matches);
+    flring_free(&d->ring);
+    memset(d, 0, sizeof(TTY_descr));
+}
+
+// return stdout to blocking mode
+static void stdout_restore(){
+    if(stdflags < 0) return;
+    fcntl(1, F_SETFL, stdflags);
+    stdflags = -1;
+}
+
 /**
  * Restore all opened TTYs to previous state, close them and free all memory
  * occupied by their descriptors
  */
 static void restore_ttys(){
     FNAME();
-    write_logblocks(1); // write rest of data
-    for(int i = 0; i < descr_amount; ++i){
-        TTY_descr *d = &descriptors[i];
-        DBG("%dth TTY: %s", i, d->portname);
-        FREE(d->portname);
-        if(!d->comfd) continue; // not opened
-        DBG("close file..");
-        ioctl(d->comfd, TCSANOW, &d->oldtty); // return TTY to previous state
-        close(d->comfd);
-        DBG("close log file..");
-        if(d->logfd > 0)
-            close(d->logfd);
-        DBG("done!\n");
-    }
+    for(int i = 0; i < descr_amount; ++i)
+        if(descriptors[i].portname) close_port(&descriptors[i]);
     FREE(descriptors);
+    lossy_final(&stdsink);
+    stdout_restore();
+    sink_flush(&comsink);
+    sink_flush(&evsink);
+    durable_del(comsink.durid);
+    durable_del(evsink.durid);
+    durable_stop();
+    if(stdsink.dropped)
+        WARNX(_("%llu records (%llu bytes) weren't written to stdout"),
+            (unsigned long long)stdsink.dropped, (unsigned long long)stdsink.droppedbytes);
+    if(stdlimit.total)
+        WARNX(_("%llu records (%llu bytes) weren't written to stdout by rate limit"),
+            (unsigned long long)stdlimit.total, (unsigned long long)stdlimit.totalbytes);
+    if(comlimit.total)
+        WARNX(_("%llu records (%llu bytes) weren't written to common log by rate limit"),
+            (unsigned long long)comlimit.total, (unsigned long long)comlimit.totalbytes);
+    FREE(stdsink.buf);
+    FREE(comsink.buf);
+    FREE(evsink.buf);
+    if(evsink.fd > 0) close(evsink.fd);
+    match_free(&patterns);
     descr_amount = 0;
+    shmtap_close();
+    netsrv_close();
+    if(epollfd > -1) close(epollfd);
+    epollfd = -1;
 }
 
 /**
@@ -318,30 +1018,128 @@ static void con_sig(int rb){
     }*
 }*/
 
+/**
+ * (Re)open side file of port log (or close it if `on` is zero) - non-critical
+ * @param s       - output
+ * @param on      - file is needed
+ * @param logname - name of log file
+ * @param suffix  - suffix of side file
+ * @param append  - append to existing file
+ * @return 1 if new empty file was opened
+ */
+static int create_sidefile(outsink *s, int on, const char *logname, const char *suffix, int append){
+    if(s->fd > 0){ // reopen
+        sink_flush(s);
+        close(s->fd);
+    }
+    s->fd = 0;
+    if(!on) return 0;
+    char fname[PATH_MAX];
+    snprintf(fname, PATH_MAX, "%s%s", logname, suffix);
+    int oflag = O_WRONLY | O_APPEND | O_CREAT;
+    if(!append) oflag |= rewrite_ifexists ? O_TRUNC : O_EXCL;
+    int fd = open(fname, oflag, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd == -1){
+        WARN("open(%s) failed", fname);
+        return 0;
+    }
+    s->fd = fd;
+    if(!s->buf){
+        s->size = flushbytes;
+        s->buf = MALLOC(char, flushbytes);
+    }
+    return lseek(fd, 0, SEEK_END) == 0;
+}
+
+/**
+ * Open timing file of port (its header is written by capture thread, see tim_start())
+ */
+static void create_timing(TTY_descr *descr, const char *logname, int append){
+    int isnew = create_sidefile(&descr->tim, descr->timing, logname, TIM_SUFFIX, append);
+    if(descr->tim.fd > 0) descr->timnew = isnew ? TIM_NEW : TIM_RESYNC;
+}
+
+/**
+ * Write header of new timing file (times are counted from its start) or resync
+ * entry of appended one (its previous entries could be written by other process)
+ * @param d - port descriptor
+ * @param t - current time (from start)
+ */
+static void tim_start(TTY_descr *d, double t){
+    if(!d->timnew) return;
+    if(d->timnew == TIM_NEW){
+        timhdr hdr = {.magick = TIM_MAGICK, .charns = d->charns, .t0 = t0};
+        sink_put(&d->tim, (const char*)&hdr, sizeof(hdr), 0.);
+        d->timprev = 0;
+    }else{
+        char entry[TIM_MAXENTRY];
+        d->timprev = (uint64_t)(t * 1e6);
+        size_t n = tim_encode(entry, d->timprev, 0);
+        sink_put(&d->tim, entry, n, t + TIM_LATENCY);
+    }
+    d->timnew = 0;
+}
+
 /**
  * Create log file (open in exclusive mode: error if file exists)
- * @param  descr - device descriptor
+ * or reopen it (after rotation or change of name) appending new data
+ * @param  descr  - device descriptor
+ * @param  append - reopen log: old log & index are closed only if new log opened
  * @return fd of opened file if all OK, 0 in case of error
  */
-int create_log(TTY_descr *descr){
+int create_log(TTY_descr *descr, int append){
     int fd;
-    char fdname[256], *filedev;
+    char fdname[PATH_MAX], *filedev;
     if(!(filedev = strrchr(descr->portname, '/'))) filedev = descr->portname;
     else{
         ++filedev;
         if(!*filedev) filedev = descr->portname;
     }
-    snprintf(fdname, 256, "log_%s.txt", filedev);
-    int oflag = O_WRONLY | O_CREAT;
-    if(rewrite_ifexists) oflag |= O_TRUNC;
-    else oflag |= O_EXCL;
+    if(descr->logname) snprintf(fdname, PATH_MAX, "%s", descr->logname);
+    else snprintf(fdname, PATH_MAX, "log_%s.txt", filedev);
+    // O_DIRECT log is written by pwrite() & partial block is read back
+    int oflag = (directio ? O_RDWR : O_WRONLY | O_APPEND) | O_CREAT;
+    if(!append) oflag |= rewrite_ifexists ? O_TRUNC : O_EXCL;
     if ((fd = open(fdname, oflag,
             S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH )) == -1){
         WARN("open(%s) failed", fdname);
         return 0;
     }
     DBG("%s opened", fdname);
-    descr->logfd = fd;
+    outsink *s = &descr->log;
+    if(s->fd > 0) sink_flush(s); // pending data belongs to old log
+    durable_del(s->durid);
+    if(s->fd > 0) close(s->fd);
+    if(descr->idxfd > 0) close(descr->idxfd);
+    s->fd = fd;
+    s->direct = directio;
+    if(directio && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT)){
+        WARN(_("Can't use O_DIRECT for %s"), fdname);
+        s->direct = 0;
+    }
+    if(!s->buf){
+        if(s->direct){
+            if(posix_memalign((void**)&s->buf, DIRECT_ALIGN, flushbytes)) ERR("posix_memalign()");
+        }else s->buf = MALLOC(char, flushbytes);
+        s->size = flushbytes;
+    }
+    descr->idxfd = -1;
+    descr->logoff = append ? (uint64_t)lseek(fd, 0, SEEK_END) : 0;
+    s->len = s->done = 0;
+    s->fileoff = descr->logoff;
+    if(s->direct && (s->done = descr->logoff % DIRECT_ALIGN)){ // read partial block
+        s->fileoff -= s->done;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        if(pread(fd, s->buf, s->done, s->fileoff) != (ssize_t)s->done) WARN(_("Can't read %s"), fdname);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT);
+        s->len = s->done;
+    }
+    s->durid = durable_add(fd, descr->logoff);
+    descr->nrec = 0;
+    if(idxstep) // continue existing index of non-empty log
+        descr->idxfd = descr->logoff ? logidx_append(fdname) : logidx_create(fdname, t0, idxstep, hdr_absolute() ? IDX_ABSTIME : 0);
+    create_timing(descr, fdname, append);
+    create_sidefile(&descr->decsink, descr->dec != NULL, fdname, DEC_SUFFIX, append);
     return fd;
 }
 
@@ -357,123 +1155,891 @@ static TTY_descr *prepare_tty(TTY_descr *descr){
         WARNX(_("Can't open device %s"), descr->portname);
         return NULL;
     }
-    if(!create_log(descr)) return NULL;
+    if(!create_log(descr, appendlogs)) return NULL;
     return descr;
 }
 
 /**
- * read all TTYs, put data into linebuffers & store full lines in log file
- * @return 1 if any buffer became full
+ * Create pty for port in passthrough mode
+ * @param rx - descriptor of real port (data from device)
+ * @param tx - descriptor for pty master (data from host software)
+ * @param slot - index of `rx` in descriptors
+ * @return 0 if all OK
  */
-static int read_ttys(){
-    struct timeval tv;
-    int i, sel, retval = 0;
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    for(i = 0; i < descr_amount; ++i)
-        FD_SET(descriptors[i].comfd, &rfds);
-    // wait no more than 10ms
-    tv.tv_sec = 0; tv.tv_usec = 10000;
-    sel = select(maxfd, &rfds, NULL, NULL, &tv);
-    TTY_descr *d = descriptors;
-    if(sel > 0) for(i = 0; i < descr_amount; ++i, ++d){
-        int bsyctr = 0;
-        if(FD_ISSET(d->comfd, &rfds)){
-            size_t L = d->logbuflen;
-            //DBG("%s got data (have %zd)",  d->portname, L);
-            char *bufptr = d->logbuf + L;
-            while(L < LOGBUFSZ){
-                usleep(1000);
-                if(read(d->comfd, bufptr, 1) < 1){ // disconnect or other troubles
-                    if(errno == EAGAIN){ // file was blocked outside
-                        if(bsyctr++ < 10) continue;
-                        break;
-                    }
-                    WARN(_("Some error or %s disconnected"), d->portname);
-                    break;
-                }else{
-                    bsyctr = 0;
-                    // all OK continue reading
-                    ++L;
-                    if(*bufptr++ == '\n'){ // line ready
-                        d->linerdy = 1;
-                        retval = 1;
-                        break;
-                    }
+static int open_pty(TTY_descr *rx, TTY_descr *tx, int slot){
+    char slavename[PATH_MAX] = {0};
+    int slave = -1, master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) || unlockpt(master) || ptsname_r(master, slavename, PATH_MAX)){
+        WARN(_("Can't create pty for %s"), rx->portname);
+        goto bad;
+    }
+    // keep slave opened, so master won't get hangup when host software closes it
+    struct termios t;
+    if((slave = open(slavename, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(slave, &t)){
+        WARN(_("Can't open %s"), slavename);
+        goto bad;
+    }
+    cfmakeraw(&t);
+    cfsetispeed(&t, rx->baudrate);
+    cfsetospeed(&t, rx->baudrate);
+    if(tcsetattr(slave, TCSANOW, &t)) WARN(_("Can't setup %s"), slavename);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    size_t L = strlen(rx->portname) + 4;
+    tx->portname = MALLOC(char, L);
+    snprintf(tx->portname, L, "%s.tx", rx->portname);
+    set_namelen(tx);
+    tx->comfd = master;
+    tx->ptyslave = slave;
+    tx->bufsz = rx->bufsz;
+    tx->logbuf = MALLOC(char, tx->bufsz);
+    set_encoding(tx, rx->encoding);
+    set_dedup(tx, rx->dedup);
+    tb_init(&tx->limit, &rx->limit.lim, 0.);
+    tx->charmode = rx->charmode;
+    tx->latency = rx->latency;
+    tx->timing = rx->timing;
+    tx->charns = rx->charns;
+    if(rx->dec) tx->dec = decoder_new(rx->dec->ops->name, rx->charns * 1e-9);
+    if(rx->logname){
+        tx->logname = MALLOC(char, strlen(rx->logname) + 4);
+        sprintf(tx->logname, "%s.tx", rx->logname);
+    }
+    tx->fwdfd = rx->comfd;
+    rx->fwdfd = master;
+    tx->peer = slot;
+    rx->peer = slot + 1;
+    rx->fwdbuf = MALLOC(char, FWDBUFSZ);
+    tx->fwdbuf = MALLOC(char, FWDBUFSZ);
+    green(_("%s <-> %s\n"), slavename, rx->portname);
+    if(!create_log(tx, appendlogs)) return 1;
+    return 0;
+bad:
+    if(slave > -1) close(slave);
+    if(master > -1) close(master);
+    return 1;
+}
+
+/**
+ * Add port into epoll or change its events
+ * @param d      - port descriptor
+ * @param op     - EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ * @param events - events to wait
+ */
+static void epoll_tty(TTY_descr *d, int op, uint32_t events){
+    struct epoll_event ev = {.events = events, .data.u64 = (uint64_t)(d - descriptors)};
+    if(epoll_ctl(epollfd, op, d->comfd, &ev)) WARN("epoll_ctl(%s)", d->portname);
+}
+
+// data read at `tread` is written to peer
+static void fwd_done(TTY_descr *d, double tread){
+    double lat = dtime() - tread;
+    fwdstat *s = &d->stat;
+    ++s->chunks;
+    s->sumlat += lat;
+    if(lat > s->maxlat) s->maxlat = lat;
+}
+
+/**
+ * Forward data read from port `d` to its peer (passthrough mode)
+ * data which can't be written now is stored in `d->fwdbuf` and written when peer is ready
+ * @param d     - port descriptor
+ * @param buf   - data
+ * @param L     - its length
+ * @param tread - time when data was read
+ */
+static void forward(TTY_descr *d, const char *buf, size_t L, double tread){
+    if(!d->fwdlen){
+        ssize_t w = write(d->fwdfd, buf, L);
+        if(w < 0){
+            if(errno != EAGAIN && errno != EINTR){
+                WARN(_("Can't forward data from %s"), d->portname);
+                return;
+            }
+            w = 0;
+        }
+        d->stat.bytes += w;
+        if((size_t)w == L){
+            fwd_done(d, tread);
+            return;
+        }
+        buf += w; L -= w;
+        d->fwdt = tread;
+        epoll_tty(&descriptors[d->peer], EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+    }
+    if(d->fwdlen + L > FWDBUFSZ){ // peer don't read data
+        d->stat.dropped += d->fwdlen + L - FWDBUFSZ;
+        L = FWDBUFSZ - d->fwdlen;
+    }
+    memcpy(d->fwdbuf + d->fwdlen, buf, L);
+    d->fwdlen += L;
+}
+
+/**
+ * Peer of `d` is ready for writing: write data pending
+ */
+static void fwd_flush(TTY_descr *d){
+    if(!d->fwdlen) return;
+    ssize_t w = write(d->fwdfd, d->fwdbuf, d->fwdlen);
+    if(w < 0){
+        if(errno == EAGAIN || errno == EINTR) return;
+        WARN(_("Can't forward data from %s"), d->portname);
+        d->stat.dropped += d->fwdlen;
+        w = d->fwdlen;
+    }else d->stat.bytes += w;
+    d->fwdlen -= w;
+    memmove(d->fwdbuf, d->fwdbuf + w, d->fwdlen);
+    if(!d->fwdlen){
+        fwd_done(d, d->fwdt);
+        epoll_tty(&descriptors[d->peer], EPOLL_CTL_MOD, EPOLLIN);
+    }
+}
+
+/**
+ * Put data read into line buffer & write records of full lines
+ * @param d   - port descriptor
+ * @param buf - data
+ * @param L   - its length
+ * @param twr - time of data (from start)
+ */
+static void put_data(TTY_descr *d, const char *buf, size_t L, double twr){
+    while(L){
+        if(!d->logbuflen) d->tfirst = twr;
+        size_t n = d->bufsz - d->logbuflen;
+        if(n > L) n = L;
+        const char *nl = memchr(buf, '\n', n);
+        if(nl) n = nl - buf + 1;
+        memcpy(d->logbuf + d->logbuflen, buf, n);
+        d->logbuflen += n;
+        buf += n; L -= n;
+        if(nl) d->linerdy = 1;
+        if(nl || d->logbuflen == d->bufsz) write_record(d, twr); // line ready or buffer is full
+    }
+    if(d->charmode && d->logbuflen){ // hold data no more than `latency`
+        double deadline = d->tfirst + d->latency;
+        if(deadline <= twr) write_record(d, d->tfirst);
+        else if(deadline < next_flush) next_flush = deadline;
+    }
+}
+
+/**
+ * Write records of ports in character mode & outputs which waited enough
+ */
+static void flush_expired(){
+    double now = dtime() - t0;
+    if(now < next_flush) return;
+    next_flush = DBL_MAX;
+    for(int i = 0; i < descr_amount; ++i){
+        TTY_descr *d = &descriptors[i];
+        if(d->charmode && d->logbuflen){
+            if(d->tfirst + d->latency <= now) write_record(d, d->tfirst);
+            else if(d->tfirst + d->latency < next_flush) next_flush = d->tfirst + d->latency;
+        }
+        if(d->dupn){ // don't collapse repeats longer than `dedup`
+            if(d->dupt0 + d->dedup <= now) dedup_flush(d);
+            else if(d->dupt0 + d->dedup < next_flush) next_flush = d->dupt0 + d->dedup;
+        }
+        sink_check(&d->log, now);
+        sink_check(&d->tim, now);
+        sink_check(&d->decsink, now);
+        if(d->dec){ // end frames by silence
+            decoder_idle(d->dec, now, on_decoded, d);
+            double dl = decoder_deadline(d->dec);
+            if(dl < next_flush) next_flush = dl;
+        }
+    }
+    sink_check(&stdsink, now);
+    sink_check(&comsink, now);
+    sink_check(&evsink, now);
+}
+
+/**
+ * Trigger of flight recorder: write records kept in rings into logs (merged by
+ * time) and log all data during `flightpost` seconds
+ * @param reason - message about trigger
+ */
+static void flight_trigger(const char *reason){
+    if(!flightsize) return;
+    double now = dtime() - t0;
+    green(_("Trigger: %s\n"), reason);
+    if(now > flight_until){ // dump records before trigger
+        double tmin = flightkeep > 0. ? now - flightkeep : -DBL_MAX;
+        while(1){
+            TTY_descr *best = NULL;
+            flrec *bestrec = NULL;
+            for(int i = 0; i < descr_amount; ++i){
+                TTY_descr *d = &descriptors[i];
+                if(!d->ring) continue;
+                flrec *r;
+                while((r = flring_peek(d->ring)) && r->t < tmin) flring_next(d->ring);
+                if(r && (!bestrec || r->t < bestrec->t)){
+                    best = d;
+                    bestrec = r;
                 }
             }
-            descriptors[i].logbuflen = L;
-            if(L == LOGBUFSZ || charmode) retval = 1; // buffer is full - write data to logs
+            if(!best) break;
+            log_record(best, bestrec->t, (char*)(bestrec + 1), bestrec->len, bestrec->addnl, now, OUT_LOG | OUT_SHARED);
+            flring_next(best->ring);
         }
     }
-    return retval;
+    flight_until = now + flightpost;
+}
+
+// time of data fed into matcher
+static double matchtime = 0.;
+
+/**
+ * Process match of pattern in data of port: count it, log event, print it
+ * on stdout & trigger flight recorder
+ * @param pat - pattern number
+ * @param arg - port descriptor
+ */
+static void on_match(int pat, _U_ size_t end, void *arg){
+    TTY_descr *d = (TTY_descr*)arg;
+    ++d->matches[pat];
+    char msg[HDRBUFSZ + PATH_MAX];
+    int L = hdr_time(msg, matchtime);
+    L += snprintf(msg + L, sizeof(msg) - L, ": %s: %s\n", d->portname, patterns->names[pat]);
+    if(L >= (int)sizeof(msg)) L = sizeof(msg) - 1;
+    if(evsink.fd > 0){
+        sink_put(&evsink, msg, L, matchtime + d->latency);
+        if(d->latency <= 0.) sink_flush(&evsink);
+    }
+    if(matchcolor && stdsink.fd > 0){ // queued records should be printed before
+        sink_flush(&stdsink);
+        if(stdsink.len == 0) red("%s", msg);
+        else ++stdsink.dropped;
+    }
+    if(pat >= firsttrig){
+        snprintf(msg, sizeof(msg), _("pattern \"%s\" on %s"), patterns->names[pat], d->portname);
+        flight_trigger(msg);
+    }
+}
+
+/**
+ * Check framing & parity errors counters of ports (every ERRCHECK_PERIOD seconds)
+ */
+static void check_errors(){
+    if(!trigerrors) return;
+    double now = dtime() - t0;
+    if(now - errcheck_t < ERRCHECK_PERIOD) return;
+    errcheck_t = now;
+    for(int i = 0; i < descr_amount; ++i){
+        TTY_descr *d = &descriptors[i];
+        struct serial_icounter_struct ic;
+        if(d->comfd <= 0 || d->ptyslave || d->disconnected || ioctl(d->comfd, TIOCGICOUNT, &ic)) continue;
+        int n = ic.frame + ic.parity;
+        if(n - d->nerrors >= trigerrors){
+            char msg[PATH_MAX];
+            snprintf(msg, PATH_MAX, _("%d framing/parity errors on %s"), n - d->nerrors, d->portname);
+            d->nerrors = n;
+            flight_trigger(msg);
+        }
+    }
+}
+
+/**
+ * Put entry of chunk read into timing file & histogram of gaps
+ * @param d - port descriptor
+ * @param t - time of chunk (from start)
+ * @param L - its length
+ */
+static void put_timing(TTY_descr *d, double t, size_t L){
+    uint64_t us = (uint64_t)(t * 1e6);
+    if(d->hist.nchunks || d->chunkprev) tim_histadd(&d->hist, us - d->chunkprev, L, d->charns);
+    d->chunkprev = us;
+    if(d->tim.fd < 1) return;
+    tim_start(d, t);
+    char entry[TIM_MAXENTRY];
+    if(us < d->timprev) us = d->timprev;
+    size_t n = tim_encode(entry, us - d->timprev, L);
+    d->timprev = us;
+    sink_put(&d->tim, entry, n, t + TIM_LATENCY);
+}
+
+/**
+ * Read all data available from port, forward it (in passthrough mode) & put into records
+ * @param d - port descriptor
+ */
+static void read_tty(TTY_descr *d){
+    char buf[RDBUFSZ];
+    int port = d - descriptors;
+    while(1){
+        PROBE1(read_start, port);
+        ssize_t L = read(d->comfd, buf, RDBUFSZ);
+        PROBE2(read_end, port, L);
+        if(L < 1){
+            if(L < 0 && (errno == EAGAIN || errno == EINTR)) return;
+            if(L < 0) WARN(_("Some error or %s disconnected"), d->portname);
+            else WARNX(_("%s disconnected"), d->portname);
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, d->comfd, NULL);
+            d->disconnected = 1;
+            return;
+        }
+        double t = dtime();
+        if(d->fwdfd > -1) forward(d, buf, L, t);
+        if(d->matches){
+            matchtime = t - t0;
+            d->mstate = match_feed(patterns, d->mstate, buf, L, on_match, d);
+        }
+        if(d->timing) put_timing(d, t - t0, L);
+        if(d->dec){
+            decoder_feed(d->dec, buf, L, t - t0, on_decoded, d);
+            double dl = decoder_deadline(d->dec);
+            if(dl < next_flush) next_flush = dl;
+        }
+        put_data(d, buf, L, t - t0);
+        if(L < RDBUFSZ) return;
+    }
+}
+
+/**
+ * wait for events of all TTYs (and socket clients), read data & store full lines in log files
+ */
+static void read_ttys(){
+    struct epoll_event events[MAXEVENTS];
+    // wait no more than 10ms or until nearest flush
+    int tmout = 10;
+    if(next_flush < DBL_MAX){
+        double dt = (next_flush - (dtime() - t0)) * 1e3;
+        if(dt < tmout) tmout = dt > 0. ? (int)dt + 1 : 0;
+    }
+    PROBE0(wait_start);
+    int n = epoll_wait(epollfd, events, MAXEVENTS, tmout);
+    PROBE1(wait_end, n);
+    for(int i = 0; i < n; ++i){
+        uint64_t data = events[i].data.u64;
+        if(data & EVTAG_NET){
+            netsrv_process((int)(uint32_t)data);
+            continue;
+        }
+        if(data & EVTAG_INIT){
+            ports_ready();
+            continue;
+        }
+        TTY_descr *d = &descriptors[data];
+        if(events[i].events & EPOLLOUT) fwd_flush(&descriptors[d->peer]);
+        if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_tty(d);
+    }
+}
+
+/**
+ * Setup descriptor(s) of port & open it
+ * @param cfg  - port settings
+ * @param d    - descriptor (in passthrough mode `d + 1` is for pty)
+ * @param slot - its index in descriptors
+ * @return 0 if all OK
+ */
+static int open_port(portcfg *cfg, TTY_descr *d, int slot){
+    DBG("open %s with speed %d, %s", cfg->name, cfg->speed, cfg->framing);
+    d->portname = STRDUP(cfg->name);
+    set_namelen(d);
+    d->fwdfd = -1;
+    if(!(d->baudrate = get_bspeed(cfg->speed)) || framing2cflag(cfg->framing, &d->cflag)){
+        WARNX(_("Wrong settings of %s: %d %s"), cfg->name, cfg->speed, cfg->framing);
+        return 1;
+    }
+    if(cfg->logname) d->logname = STRDUP(cfg->logname);
+    if(cfg->cpus) d->cpus = STRDUP(cfg->cpus);
+    d->bufsz = cfg->bufsize;
+    d->logbuf = MALLOC(char, cfg->bufsize);
+    set_encoding(d, cfg->encoding);
+    set_dedup(d, cfg->dedup);
+    tb_init(&d->limit, &cfg->limit, 0.);
+    d->charmode = cfg->charmode;
+    d->latency = cfg->latency / 1e3;
+    d->timing = cfg->timing;
+    d->charns = char_ns(cfg->speed, d->cflag);
+    if(cfg->decoder) d->dec = decoder_new(cfg->decoder, d->charns * 1e-9);
+    if(!prepare_tty(d)) return 1;
+    if(passthrough && open_pty(d, d + 1, slot)) return 1;
+    return 0;
+}
+
+// add port to epoll & outputs
+static void start_port(int slot){
+    TTY_descr *d = &descriptors[slot];
+    tim_start(d, dtime() - t0);
+    if(flightsize) d->ring = flring_new(flightsize);
+    if(patterns) d->matches = MALLOC(uint64_t, patterns->npatterns); // both directions of passthrough too
+    struct serial_icounter_struct ic;
+    if(!d->ptyslave && !ioctl(d->comfd, TIOCGICOUNT, &ic)) d->nerrors = ic.frame + ic.parity;
+    epoll_tty(d, EPOLL_CTL_ADD, EPOLLIN);
+    shmtap_setport(slot, d->portname, d->encoding);
+    netsrv_setport(slot, d->portname);
+}
+
+/**
+ * Open log file of output (common log or log of matches) - non-critical
+ * @param s     - output
+ * @param name  - file name
+ * @param oflag - additional open() flags
+ */
+static void open_sinklog(outsink *s, const char *name, int oflag){
+    if(!name) return;
+    int fd = open(name, O_WRONLY | O_CREAT | oflag, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd == -1){
+        WARN("open(%s) failed", name);
+        return;
+    }
+    sink_flush(s);
+    durable_del(s->durid);
+    if(s->fd > 0) close(s->fd);
+    s->fd = fd;
+    s->fileoff = (oflag & O_APPEND) ? (uint64_t)lseek(fd, 0, SEEK_END) : 0;
+    s->durid = durable_add(fd, s->fileoff);
+}
+
+/**
+ * Apply new settings to opened port (and its pty in passthrough mode)
+ * @param d   - port descriptor
+ * @param cfg - new settings
+ */
+static void update_port(TTY_descr *d, portcfg *cfg){
+    tcflag_t cflag;
+    int bspeed = get_bspeed(cfg->speed);
+    if(!bspeed || framing2cflag(cfg->framing, &cflag)) return; // checked by config reader
+    int n = passthrough ? 2 : 1;
+    if(bspeed != d->baudrate || cflag != d->cflag || d->disconnected){ // reinit port
+        d->baudrate = bspeed;
+        d->cflag = cflag;
+        if(d->disconnected){ // try to open it again
+            if(d->comfd > 0) close(d->comfd);
+            d->comfd = 0;
+        }
+        if(tty_init(d)) WARNX(_("Can't reinit %s"), d->portname);
+        else if(d->disconnected){
+            d->disconnected = 0;
+            epoll_tty(d, EPOLL_CTL_ADD, EPOLLIN);
+            if(passthrough) d[1].fwdfd = d->comfd;
+        }
+    }
+    for(int i = 0; i < n; ++i){
+        TTY_descr *cur = &d[i];
+        if(cfg->bufsize != cur->bufsz || cfg->encoding != cur->encoding || cfg->dedup != cur->dedup){
+            if(cur->logbuflen) write_record(cur, dtime() - t0);
+            if(cfg->bufsize != cur->bufsz){
+                FREE(cur->logbuf);
+                cur->bufsz = cfg->bufsize;
+                cur->logbuf = MALLOC(char, cur->bufsz);
+            }
+            set_encoding(cur, cfg->encoding);
+            shmtap_setport(cur - descriptors, cur->portname, cur->encoding);
+            set_dedup(cur, cfg->dedup);
+        }
+        if(memcmp(&cfg->limit, &cur->limit.lim, sizeof(ratelimit))){
+            double now = dtime() - t0;
+            limit_flush(cur, now);
+            tb_init(&cur->limit, &cfg->limit, now);
+        }
+        cur->charmode = cfg->charmode;
+        cur->latency = cfg->latency / 1e3;
+        cur->timing = cfg->timing;
+        uint32_t charns = char_ns(cfg->speed, cflag);
+        const char *decname = cur->dec ? cur->dec->ops->name : NULL;
+        if(!cfg->decoder != !decname || (decname && (strcasecmp(cfg->decoder, decname) || charns != cur->charns))){
+            close_decoder(cur);
+            if(cfg->decoder) cur->dec = decoder_new(cfg->decoder, charns * 1e-9);
+        }
+        cur->charns = charns;
+    }
+    FREE(d->cpus);
+    if(cfg->cpus) d->cpus = STRDUP(cfg->cpus);
+    // log name (new log would be opened by create_log())
+    FREE(d->logname);
+    FREE(d[n-1].logname);
+    if(cfg->logname){
+        d->logname = STRDUP(cfg->logname);
+        if(passthrough){
+            d[1].logname = MALLOC(char, strlen(cfg->logname) + 4);
+            sprintf(d[1].logname, "%s.tx", cfg->logname);
+        }
+    }
+}
+
+/**
+ * Collect CPUs of ports opened: capture thread would be pinned to them
+ * (or to CPUs of command line if no port have own)
+ */
+static void port_cpus(){
+    rt_portcpus(NULL);
+    for(int i = 0; i < descr_amount; ++i)
+        if(descriptors[i].portname && descriptors[i].cpus) rt_portcpus(descriptors[i].cpus);
+}
+
+/**
+ * Reload configuration (on SIGHUP): close ports removed, open new ones, apply
+ * changed settings & reopen log files (after rotation); other ports are
+ * read without breaks
+ */
+static void reconfigure(){
+    reload = 0;
+    mem_steady(0);
+    int nports = 0, n = passthrough ? 2 : 1;
+    portcfg *ports = NULL;
+    if(getports && !(ports = getports(&nports)))
+        WARNX(_("Wrong configuration, only logs would be reopened"));
+    char *found = ports ? MALLOC(char, nports) : NULL;
+    for(int i = 0; i < descr_amount; i += n){
+        TTY_descr *d = &descriptors[i];
+        if(!d->portname) continue; // empty slot
+        if(ports){
+            int j;
+            for(j = 0; j < nports; ++j)
+                if(!found[j] && strcmp(ports[j].name, d->portname) == 0) break;
+            if(j == nports){
+                green(_("%s removed\n"), d->portname);
+                for(int k = 0; k < n; ++k) close_port(&d[k]);
+                continue;
+            }
+            found[j] = 1;
+            update_port(d, &ports[j]);
+        }
+        for(int k = 0; k < n; ++k){
+            if(!create_log(&d[k], 1)) WARNX(_("Old log of %s is used"), d[k].portname);
+            tim_start(&d[k], dtime() - t0);
+        }
+    }
+    open_sinklog(&comsink, commonlogname, O_APPEND);
+    open_sinklog(&evsink, evlogname, O_APPEND);
+    for(int j = 0; j < nports; ++j){
+        if(found[j]) continue;
+        int slot;
+        for(slot = 0; slot < descr_amount; slot += n)
+            if(!descriptors[slot].portname) break;
+        if(slot == descr_amount){
+            descriptors = REALLOC(descriptors, TTY_descr, descr_amount + n);
+            memset(&descriptors[descr_amount], 0, n * sizeof(TTY_descr));
+            descr_amount += n;
+        }
+        if(open_port(&ports[j], &descriptors[slot], slot)){
+            WARNX(_("Can't add %s"), ports[j].name);
+            for(int k = 0; k < n; ++k) close_port(&descriptors[slot + k]);
+            continue;
+        }
+        green(_("%s added\n"), ports[j].name);
+        for(int k = 0; k < n; ++k) start_port(slot + k);
+    }
+    FREE(found);
+    portcfg_free(ports, nports);
+    port_cpus();
+    rt_pin();
+    mem_steady(1);
+}
+
+// thread of pool: open ports one by one
+static void *init_worker(_U_ void *arg){
+    int i, n = passthrough ? 2 : 1;
+    while((i = __atomic_fetch_add(&pinit.next, 1, __ATOMIC_RELAXED)) < pinit.nports){
+        double t = dtime();
+        int ret = open_port(&pinit.ports[i], &pinit.descr[i * n], i * n);
+        pinit.tinit[i] = dtime() - t;
+        __atomic_store_n(&pinit.state[i], ret ? PINIT_FAIL : PINIT_READY, __ATOMIC_RELEASE);
+        uint64_t one = 1;
+        if(write(pinit.evfd, &one, sizeof(one)) < 0) WARN("write(eventfd)");
+    }
+    return NULL;
+}
+
+// wait for pool & free it
+static void init_join(){
+    if(!pinit.threads) return;
+    for(int i = 0; i < pinit.nthreads; ++i) pthread_join(pinit.threads[i], NULL);
+    FREE(pinit.threads);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, pinit.evfd, NULL);
+    close(pinit.evfd);
+    pinit.evfd = -1;
+}
+
+/**
+ * Stop pool & move ports opened by it into descriptors, so they would be restored at exit
+ */
+static void init_abort(){
+    if(!pinit.threads) return;
+    __atomic_store_n(&pinit.next, pinit.nports, __ATOMIC_RELAXED); // don't open other ports
+    init_join();
+    int n = passthrough ? 2 : 1;
+    for(int i = 0; i < pinit.nports; ++i)
+        if(pinit.state[i] != PINIT_STARTED)
+            memcpy(&descriptors[i * n], &pinit.descr[i * n], n * sizeof(TTY_descr));
+}
+
+// all ports are started: print time of their initialization & go into steady state
+static void init_done(){
+    init_join();
+    double tall = dtime() - pinit.tstart;
+    for(int i = 0; i < pinit.nports; ++i)
+        green(_("%s: opened in %.1f ms\n"), pinit.ports[i].name, pinit.tinit[i] * 1e3);
+    green(_("%d ports opened in %.3f s by %d threads\n"), pinit.nports, tall, pinit.nthreads);
+    FREE(pinit.state);
+    FREE(pinit.tinit);
+    FREE(pinit.descr);
+    port_cpus();
+    rt_apply(); // all buffers are allocated: lock memory & change scheduling
+    mem_steady(1);
+}
+
+/**
+ * Start capture of ports opened by pool (called on its eventfd events)
+ */
+static void ports_ready(){
+    uint64_t cnt;
+    if(read(pinit.evfd, &cnt, sizeof(cnt)) < 0) return;
+    int n = passthrough ? 2 : 1;
+    for(int i = 0; i < pinit.nports; ++i){
+        int st = __atomic_load_n(&pinit.state[i], __ATOMIC_ACQUIRE);
+        if(st == PINIT_FAIL) term_quit(globErr ? globErr : 1); // ports opened would be restored
+        if(st != PINIT_READY) continue;
+        memcpy(&descriptors[i * n], &pinit.descr[i * n], n * sizeof(TTY_descr));
+        for(int k = 0; k < n; ++k) start_port(i * n + k);
+        pinit.state[i] = PINIT_STARTED;
+        ++pinit.started;
+    }
+    if(pinit.started == pinit.nports) init_done();
 }
 
 /**
- * Open all TTY's from given lists & start monitoring
- * @param ports     - TTY device filename
- * @param speeds    - array of speeds or NULL
- * @param globspeed - common speed for all ports (if `speeds` not NULL)
+ * Open all TTY's from given lists & start monitoring: ports are opened by pool
+ * of threads, each of them is captured as soon as it's ready
+ * @param ports  - settings of ports
+ * @param nports - their amount
  */
-void ttys_open(char **ports, int **speeds, int globspeed){
-    int commonspd = 0, N = 0;
-    if(!speeds) commonspd = conv_spd(globspeed);
-    // count amount of ports to open
-    char **p = ports;
-    for(descr_amount = 0; *p; ++descr_amount, ++p);
-    DBG("User wanna open %d descriptors", descr_amount);
+void ttys_open(portcfg *ports, int nports){
+    DBG("User wanna open %d ports", nports);
+    // in passthrough mode each port have two descriptors: for device & for pty
+    int n = passthrough ? 2 : 1;
+    descr_amount = n * nports;
     descriptors = MALLOC(TTY_descr, descr_amount); // allocate memory for descriptors array
-    while(*ports){
-        int spd = commonspd ? commonspd : conv_spd(**speeds);
-        DBG("open %s with speed %d (%d)", *ports, commonspd ? globspeed : **speeds, spd);
-        TTY_descr *cur_descr = &descriptors[N++];
-        cur_descr->portname = strdup(*ports);
-        cur_descr->baudrate = spd;
-        if(!prepare_tty(cur_descr)) term_quit(globErr);
-        ++ports;
-        if(!commonspd) ++speeds;
-    }
-    if(commonlogname){ // open common log file - non-critical
-        int oflag = O_WRONLY | O_CREAT;
-        if(rewrite_ifexists) oflag |= O_TRUNC; // truncate if -r passed
-        if ((common_fd = open(commonlogname, oflag,
-            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH )) == -1)
-                WARN("open(%s) failed", commonlogname);
+    if(t0 < 0.) t0 = dtime();
+    hdr_setup(timefmt, t0);
+    if((epollfd = epoll_create1(0)) < 0) ERR("epoll_create1()");
+    if(stdsink.fd > 0){ // stdout never blocks capture
+        stdsink.buf = MALLOC(char, stdsink.size);
+        if((stdflags = fcntl(1, F_GETFL)) > -1){
+            atexit(stdout_restore); // stdout can be shared with shell: restore it on any exit
+            fcntl(1, F_SETFL, stdflags | O_NONBLOCK);
+        }
+    }
+    comsink.size = flushbytes;
+    comsink.buf = MALLOC(char, flushbytes);
+    durable_start();
+    open_sinklog(&comsink, commonlogname, rewrite_ifexists ? O_TRUNC : 0); // truncate if -r passed
+    if(evlogname){
+        evsink.size = flushbytes;
+        evsink.buf = MALLOC(char, flushbytes);
+        open_sinklog(&evsink, evlogname, O_APPEND | (rewrite_ifexists && !appendlogs ? O_TRUNC : 0));
+    }
+    if(shmname) shmtap_open(shmname, shmsize, t0); // shared memory ring - non-critical too
+    if(listenaddr){ // socket for viewers
+        size_t maxbuf = 0;
+        for(int i = 0; i < nports; ++i){
+            size_t L = enc_maxlen(ports[i].encoding, ports[i].bufsize);
+            if(L > maxbuf) maxbuf = L;
+        }
+        netsrv_open(listenaddr, epollfd, EVTAG_NET, HDRBUFSZ + maxbuf + 1);
+    }
+    pinit.ports = ports;
+    pinit.nports = nports;
+    pinit.state = MALLOC(int, nports + 1);
+    pinit.tinit = MALLOC(double, nports + 1);
+    pinit.descr = MALLOC(TTY_descr, descr_amount + 1);
+    pinit.tstart = dtime();
+    if(nports < 1) init_done();
+    else{
+        if((pinit.evfd = eventfd(0, EFD_NONBLOCK)) < 0) ERR("eventfd()");
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVTAG_INIT};
+        if(epoll_ctl(epollfd, EPOLL_CTL_ADD, pinit.evfd, &ev)) ERR("epoll_ctl()");
+        pinit.nthreads = initthreads < nports ? initthreads : nports;
+        pinit.threads = MALLOC(pthread_t, pinit.nthreads);
+        // signals are handled by capture thread only (term_quit() waits for pool)
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for(int i = 0; i < pinit.nthreads; ++i)
+            if(pthread_create(&pinit.threads[i], NULL, init_worker, NULL)) ERR(_("Can't create thread"));
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
     }
     // start monitoring
     while(1){
-        if(read_ttys()) write_logblocks(0);
+        read_ttys();
+        netsrv_flush();
+        flush_expired();
+        if(usrtrigger){
+            usrtrigger = 0;
+            flight_trigger("SIGUSR2");
+        }
+        check_errors();
+        if(reload && !pinit.threads) reconfigure(); // new ports could be added only after start
     }
 }
 
 /**
- * Write all received data into log files
- * @param force == 1 to write all data (@ exit)
+ * Write record into per-port log & common log
+ * @param d        - port descriptor
+ * @param twr      - time of record (from start)
+ * @param data     - payload
+ * @param len      - its length
+ * @param addnl    - add '\n' after payload
+ * @param deadline - time when outputs should be written
+ * @param outs     - outputs: OUT_LOG - per-port log, OUT_SHARED - common log
  */
-static void write_logblocks(char force){
-    TTY_descr *d = descriptors;
-    char tmbuf[256];
-    if(t0 < 0.) t0 = dtime();
-    double twr = dtime() - t0;
-    for(int i = 0; i < descr_amount; ++i, ++d){
-        if(charmode || (force && d->logbuflen) || d->linerdy || d->logbuflen == LOGBUFSZ){
-            // write trailing '\n' if `force` active
-            int writen = ((force || charmode) && !d->linerdy) ? 1 : 0;
-            size_t L = snprintf(tmbuf, 256, "%g\n", twr);
-            write(d->logfd, tmbuf, L);
-            write(d->logfd, d->logbuf, d->logbuflen);
-            if(writen) write(d->logfd, "\n", 1);
-            L = snprintf(tmbuf, 256, "%g: %s\n", twr, d->portname);
-            write(1, tmbuf, L);
-            write(1, d->logbuf, d->logbuflen);
-            if(writen) write(1, "\n", 1);
-            if(common_fd > 0){
-                write(common_fd, tmbuf, L);
-                write(common_fd, d->logbuf, d->logbuflen);
-                if(writen) write(common_fd, "\n", 1);
-            }
-            d->linerdy = 0;
-            d->logbuflen = 0;
+static void log_record(TTY_descr *d, double twr, const char *data, size_t len, int addnl, double deadline, int outs){
+    char tmbuf[HDRBUFSZ];
+    size_t L;
+    if(outs & OUT_LOG){
+        L = hdr_port(tmbuf, twr, addnl);
+        if(d->idxfd > 0 && d->nrec++ % idxstep == 0)
+            logidx_add(d->idxfd, hdr_abstime(twr), d->logoff);
+        d->logoff += L + len + addnl;
+        sink_put(&d->log, tmbuf, L, deadline);
+        sink_put(&d->log, data, len, deadline);
+        if(addnl) sink_put(&d->log, "\n", 1, deadline);
+    }
+    if((outs & OUT_SHARED) && comsink.fd > 0){
+        L = hdr_common(tmbuf, twr, d->portname, d->namelen, addnl);
+        if(sink_limit(&comsink, twr, L + len + addnl)){
+            sink_put(&comsink, tmbuf, L, deadline);
+            sink_put(&comsink, data, len, deadline);
+            if(addnl) sink_put(&comsink, "\n", 1, deadline);
+        }
+    }
+}
+
+/**
+ * Write record into log files & other outputs
+ * (outputs are written at once if port's latency is zero, else batched;
+ * in flight recorder mode record is put into port's ring instead of logs)
+ * @param d     - port descriptor
+ * @param twr   - time of record (from start)
+ * @param data  - payload
+ * @param len   - its length
+ * @param writen - add '\n' after payload
+ * @param outs  - outputs: OUT_LOG - per-port log, OUT_SHARED - all others
+ */
+static void output_record(TTY_descr *d, double twr, const char *data, size_t len, int writen, int outs){
+    char tmbuf[HDRBUFSZ];
+    int i = d - descriptors;
+    double deadline = twr + d->latency;
+    PROBE3(record, i, len, writen);
+    if(d->ring && twr > flight_until){
+        if(outs & OUT_LOG) flring_put(d->ring, twr, data, len, writen);
+    }else log_record(d, twr, data, len, writen, deadline, outs);
+    if(!(outs & OUT_SHARED)){
+        if(d->latency <= 0.) sink_flush(&d->log);
+        return;
+    }
+    size_t L = hdr_common(tmbuf, twr, d->portname, d->namelen, writen);
+    // stdout & socket clients get encoded data (encoded once for both)
+    const char *out = data;
+    size_t outlen = len;
+    int outnl = writen;
+    if(d->encoding && len <= (size_t)d->bufsz && (stdsink.fd > 0 || listenaddr)){
+        outlen = enc_encode(d->encoding, d->encbuf, data, len);
+        out = d->encbuf;
+        outnl = 1;
+    }
+    if(sink_limit(&stdsink, twr, L + outlen + outnl) && sink_room(&stdsink, L + outlen + outnl)){
+        sink_put(&stdsink, tmbuf, L, deadline);
+        sink_put(&stdsink, out, outlen, deadline);
+        if(outnl) sink_put(&stdsink, "\n", 1, deadline);
+    }
+    if(d->latency <= 0.){ // exact mode
+        sink_flush(&d->log);
+        sink_flush(&stdsink);
+        sink_flush(&comsink);
+    }
+    shmtap_put(i, twr, data, len);
+    netsrv_put(i, tmbuf, L, out, outlen, outnl);
+}
+
+/**
+ * Write marker about records dropped by rate limit of port
+ */
+static void limit_flush(TTY_descr *d, double t){
+    char msg[RL_MARKERLEN];
+    size_t L = tb_marker(&d->limit, msg);
+    // records dropped are in port's log if limit is only for shared outputs
+    if(L) output_record(d, t, msg, L, 1, d->limit.lim.full ? OUT_SHARED : OUT_LOG | OUT_SHARED);
+}
+
+/**
+ * Write record of port checking its rate limit (records over limit are dropped
+ * or written only into port's log; marker about them is written before next
+ * record passed)
+ */
+static void port_record(TTY_descr *d, double twr, const char *data, size_t len, int writen){
+    if(rl_active(&d->limit.lim)){
+        if(!tb_pass(&d->limit, twr, len + writen)){
+            if(d->limit.lim.full) output_record(d, twr, data, len, writen, OUT_LOG);
+            return;
+        }
+        limit_flush(d, twr);
+    }
+    output_record(d, twr, data, len, writen, OUT_LOG | OUT_SHARED);
+}
+
+/**
+ * Write record "last line repeated N times" if repeats of previous record were collapsed
+ */
+static void dedup_flush(TTY_descr *d){
+    if(!d->dupn) return;
+    char msg[128];
+    int L = snprintf(msg, sizeof(msg), "last line repeated %llu times over %.3f s",
+        (unsigned long long)d->dupn, d->dupt - d->dupt0);
+    port_record(d, d->dupt, msg, L, 1);
+    d->dupn = 0;
+    d->duplen = -1; // next repeat would be written in full
+}
+
+// fast hash of record (FNV-1a by 8-byte words)
+static uint64_t rec_hash(const char *data, size_t len){
+    uint64_t h = 14695981039346656037ULL, w;
+    for(; len >= 8; data += 8, len -= 8){
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    for(; len; ++data, --len) h = (h ^ (uint8_t)*data) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * Check if record in `d->logbuf` repeats previous one (it's just counted then);
+ * records are compared by memcmp() only if their lengths & hashes are equal
+ * @return 1 if record shouldn't be written
+ */
+static int dedup_check(TTY_descr *d, double twr){
+    d->loghash = rec_hash(d->logbuf, d->logbuflen);
+    if(d->logbuflen != d->duplen || d->loghash != d->duphash || memcmp(d->logbuf, d->dupbuf, d->duplen)){
+        dedup_flush(d);
+        return 0;
+    }
+    if(twr - d->dupt0 >= d->dedup){ // collapsed too long: write summary & record itself
+        dedup_flush(d);
+        return 0;
+    }
+    if(!d->dupn++ && d->dupt0 + d->dedup < next_flush) next_flush = d->dupt0 + d->dedup;
+    d->dupt = twr;
+    return 1;
+}
+
+/**
+ * Write record with data from `d->logbuf` into log files & other outputs
+ * (repeats of previous record are collapsed if `d->dedup` is set)
+ * @param d   - port descriptor
+ * @param twr - time of record (from start)
+ */
+static void write_record(TTY_descr *d, double twr){
+    // write trailing '\n' if line isn't full: each record is "header\npayload\n"
+    if(!d->dedup || !dedup_check(d, twr)){
+        port_record(d, twr, d->logbuf, d->logbuflen, !d->linerdy);
+        if(d->dedup){ // keep record to compare with next ones: just swap buffers
+            char *b = d->dupbuf;
+            d->dupbuf = d->logbuf;
+            d->logbuf = b;
+            d->duplen = d->logbuflen;
+            d->duphash = d->loghash;
+            d->dupt0 = twr;
         }
     }
+    d->linerdy = 0;
+    d->logbuflen = 0;
 }
@@ -23,12 +23,65 @@
 #define __TERM_H__
 
 #include <termios.h>        // tcsetattr, baudrates
+#include "ratelim.h"
+
+// default size of line buffer
+#define LOGBUFSZ (1024)
+// default & min amount of bytes batched in each output
+#define FLUSH_DEFBYTES (65536)
+#define FLUSH_MINBYTES (4096)
+// default size of stdout queue (bytes) & time between tries to write it when it's blocked (s)
+#define STDQ_DEFSIZE   (1024*1024)
+#define SINK_RETRY     (0.01)
+// max time of waiting for stdout at exit (s), the rest of queue is dropped
+#define SINK_FINALWAIT (1.0)
+// default amount of threads opening ports at start
+#define INIT_DEFTHREADS (8)
+// period of checking errors counters (s)
+#define ERRCHECK_PERIOD (0.1)
+
+// settings of single port
+typedef struct {
+    char *name;         // device filename
+    int speed;          // baudrate (bauds/s)
+    char *framing;      // data bits, parity & stop bits ("8N1")
+    int charmode;       // use character mode instead of lines
+    int bufsize;        // size of line buffer
+    char *logname;      // name of log file (NULL - log_<dev>.txt)
+    int latency;        // max time of data waiting in buffers, ms (0 - write each record at once)
+    int timing;         // write times of data chunks into timing file
+    char *decoder;      // protocol decoder (NULL - none)
+    int encoding;       // encoding of data in stdout & socket outputs (encoding from encode.h)
+    int dedup;          // max time of collapsing repeated records, s (0 - don't collapse)
+    ratelimit limit;    // rate limit of records
+    char *cpus;         // CPUs of capture thread (like "2" or "2-3") or NULL
+} portcfg;
 
 void term_quit(int ex_stat);
+int get_bspeed(int speed);
 int conv_spd(int speed);
-void ttys_open(char **ports, int **speeds, int globspeed);
+int framing2cflag(const char *framing, tcflag_t *cflag);
+void ttys_open(portcfg *ports, int nports);
 
 void set_comlogname(char* nm);
-void set_charmode();
+void set_portsgetter(portcfg *(*fn)(int *nports));
+void term_reload(int sig);
+void set_passthrough();
+void set_flushbytes(int bytes);
+void set_initthreads(int n);
+void set_directio();
+void set_stdqueue(int kbytes);
+void set_starttime(double t, int append);
+void set_sinklimits(const ratelimit *common, const ratelimit *std);
+void term_trigger(int sig);
+void set_flight(int sizemb, int keep, int post);
+void set_patterns(char **match, char **trigger);
+void set_matchlog(char *name);
+void set_matchcolor();
+void set_trigerrors(int n);
+void set_timeformat(int format);
+void set_idxstep(int step);
+void set_shmname(char *nm, int sizemb);
+void set_listenaddr(char *addr);
 
 #endif // __TERM_H__
@@ -0,0 +1,112 @@
+/*
+ * timing.c - compact delta-encoded times of data chunks read from ports
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include "timing.h"
+
+/**
+ * LEB128-like unsigned varint
+ * @param out - buffer (at least 10 bytes)
+ * @param v   - value
+ * @return length of encoded value
+ */
+size_t put_varint(char *out, uint64_t v){
+    size_t n = 0;
+    while(v > 0x7f){
+        out[n++] = (char)(0x80 | (v & 0x7f));
+        v >>= 7;
+    }
+    out[n++] = (char)v;
+    return n;
+}
+
+/**
+ * Decode varint
+ * @return its length or 0 if data is broken or incomplete
+ */
+size_t get_varint(const char *buf, size_t len, uint64_t *v){
+    uint64_t r = 0;
+    for(size_t n = 0; n < len && n < 10; ++n){
+        uint8_t b = (uint8_t)buf[n];
+        r |= (uint64_t)(b & 0x7f) << (7 * n);
+        if(!(b & 0x80)){
+            *v = r;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Encode entry of timing file
+ * @param out    - buffer (at least TIM_MAXENTRY bytes)
+ * @param dtus   - time since previous chunk, us
+ * @param nbytes - amount of bytes in chunk
+ * @return length of entry
+ */
+size_t tim_encode(char *out, uint64_t dtus, uint32_t nbytes){
+    size_t n = put_varint(out, dtus);
+    return n + put_varint(out + n, nbytes);
+}
+
+/**
+ * Decode entry of timing file
+ * @return length of entry or 0 if data is broken or incomplete
+ */
+size_t tim_decode(const char *buf, size_t len, uint64_t *dtus, uint32_t *nbytes){
+    uint64_t nb;
+    size_t n = get_varint(buf, len, dtus);
+    if(!n) return 0;
+    size_t m = get_varint(buf + n, len - n, &nb);
+    if(!m || nb > UINT32_MAX) return 0;
+    *nbytes = (uint32_t)nb;
+    return n + m;
+}
+
+/**
+ * Add idle gap before chunk into histogram
+ * @param h      - histogram
+ * @param dtus   - time since previous chunk, us
+ * @param nbytes - amount of bytes in chunk
+ * @param charns - transmission time of single character, ns
+ */
+void tim_histadd(timhist *h, uint64_t dtus, uint32_t nbytes, uint32_t charns){
+    uint64_t tx = ((uint64_t)nbytes * charns) / 1000, gap = dtus > tx ? dtus - tx : 0;
+    int bin = gap ? 64 - __builtin_clzll(gap) : 0; // gap < 2^bin us
+    if(bin > TIM_NBINS - 1) bin = TIM_NBINS - 1;
+    ++h->bins[bin];
+    ++h->nchunks;
+    h->nbytes += nbytes;
+    if(gap > h->maxgap) h->maxgap = gap;
+}
+
+/**
+ * Print non-empty bins of histogram
+ */
+void tim_histprint(const timhist *h, FILE *f){
+    fprintf(f, "\t%llu chunks, %llu bytes, max gap %lluus\n", (unsigned long long)h->nchunks,
+            (unsigned long long)h->nbytes, (unsigned long long)h->maxgap);
+    for(int i = 0; i < TIM_NBINS; ++i){
+        if(!h->bins[i]) continue;
+        if(i == 0) fprintf(f, "\t%12s", "<1us");
+        else if(i == TIM_NBINS - 1) fprintf(f, "\t>=%10lluus", 1ULL << (i - 1));
+        else fprintf(f, "\t%10lluus+", 1ULL << (i - 1));
+        fprintf(f, ": %llu (%.1f%%)\n", (unsigned long long)h->bins[i], 100. * h->bins[i] / h->nchunks);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * timing.h - compact delta-encoded times of data chunks read from ports
+ *
+ * Copyright 2016 Edward V. Emelianov <eddy@sao.ru, edward.emelianoff@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#pragma once
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Timing file "logname.tim" contains header and entry per each chunk of data
+ * read from port: varint of time since previous chunk (us) & varint of amount
+ * of bytes (on slow ports each chunk is a single byte).
+ * Idle gap before chunk is its time delta minus transmission time of its bytes.
+ * Entry with zero bytes is resync entry (written when file is appended): its
+ * time is time from capture start, next entries are deltas from it.
+ */
+
+// suffix of timing file
+#define TIM_SUFFIX      ".tim"
+// timing file magick
+#define TIM_MAGICK      "MTTIM01"
+// max size of encoded entry
+#define TIM_MAXENTRY    (20)
+// amount of histogram bins: [0, 1us), [1, 2us), [2, 4us) ... [2^(N-2)us, inf)
+#define TIM_NBINS       (26)
+// max time of timing data waiting in buffer (s)
+#define TIM_LATENCY     (1.)
+
+typedef struct{
+    char magick[8];     // TIM_MAGICK
+    uint32_t charns;    // transmission time of single character, ns
+    uint32_t flags;     // reserved
+    double t0;          // UNIX time of capture start
+} timhdr;
+
+// histogram of idle gaps between chunks
+typedef struct{
+    uint64_t bins[TIM_NBINS];
+    uint64_t nchunks;   // amount of chunks
+    uint64_t nbytes;    // amount of bytes
+    uint64_t maxgap;    // max gap, us
+} timhist;
+
+size_t put_varint(char *out, uint64_t v);
+size_t get_varint(const char *buf, size_t len, uint64_t *v);
+size_t tim_encode(char *out, uint64_t dtus, uint32_t nbytes);
+size_t tim_decode(const char *buf, size_t len, uint64_t *dtus, uint32_t *nbytes);
+void tim_histadd(timhist *h, uint64_t dtus, uint32_t nbytes, uint32_t charns);
+void tim_histprint(const timhist *h, FILE *f);
+
+#endif // __TIMING_H__
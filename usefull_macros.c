@@ -19,6 +19,7 @@
  * MA 02110-1301, USA.
  */
 
+#include <assert.h>
 #include "usefull_macros.h"
 
 /**
@@ -144,6 +145,22 @@ void initial_setup(){
 /******************************************************************************\
  *                                  Memory
 \******************************************************************************/
+// allocations are forbidden (steady state of capture) & amount of allocations done there
+static int mem_steady_flag = 0;
+static size_t mem_steady_cnt = 0;
+// amount of pools' blocks allocated outside of pools
+static size_t mem_pool_fallbacks_cnt = 0;
+
+// count allocation of `size` bytes if it's done in steady state
+static void steady_check(_U_ size_t size){
+    if(!mem_steady_flag) return;
+    ++mem_steady_cnt;
+    DBG("allocation of %zd bytes in steady state", size);
+#ifdef EBUG
+    assert(!mem_steady_flag);
+#endif
+}
+
 /*
  * safe memory allocation for macro ALLOC
  * @param N - number of elements to allocate
@@ -151,12 +168,116 @@ void initial_setup(){
  * @return pointer to allocated memory area
  */
 void *my_alloc(size_t N, size_t S){
+    steady_check(N * S);
     void *p = calloc(N, S);
     if(!p) ERR("malloc");
     //assert(p);
     return p;
 }
 
+/**
+ * Safe realloc() for macro REALLOC (counted in steady state like my_alloc())
+ */
+void *my_realloc(void *ptr, size_t size){
+    steady_check(size);
+    void *p = realloc(ptr, size);
+    if(!p) ERR("realloc");
+    return p;
+}
+
+/**
+ * Safe strdup() for macro STRDUP (counted in steady state like my_alloc())
+ */
+char *my_strdup(const char *s){
+    steady_check(strlen(s) + 1);
+    char *p = strdup(s);
+    if(!p) ERR("strdup");
+    return p;
+}
+
+/**
+ * Mark start (`on` == 1) or end of steady state: all memory should be allocated
+ * before it (my_alloc(), my_realloc() & my_strdup() calls are counted & in
+ * debug mode they abort program)
+ */
+void mem_steady(int on){
+    mem_steady_flag = on;
+}
+
+/**
+ * @return amount of allocations in steady state
+ */
+size_t mem_steady_allocs(){
+    return mem_steady_cnt;
+}
+
+/**
+ * @return amount of blocks allocated outside of pools (pool was empty or block too large)
+ */
+size_t mem_pool_fallbacks(){
+    return mem_pool_fallbacks_cnt;
+}
+
+/**
+ * Create pool of `nblocks` blocks with size `blksz`
+ * all memory is allocated at once, blocks are recycled by free list
+ * @return pool created
+ */
+mempool *pool_create(size_t blksz, size_t nblocks){
+    mempool *p = MALLOC(mempool, 1);
+    blksz = (blksz + 15) & ~(size_t)15; // align by 16 (and not less than pointer)
+    if(blksz == 0) blksz = 16;
+    p->blksz = blksz;
+    p->nblocks = nblocks;
+    p->area = MALLOC(char, blksz * nblocks);
+    for(size_t i = nblocks; i > 0; --i){ // first block would be first in list
+        void **b = (void**)(p->area + (i - 1) * blksz);
+        *b = p->freelist;
+        p->freelist = b;
+    }
+    p->nfree = nblocks;
+    return p;
+}
+
+/**
+ * Get block from pool (its content isn't cleared)
+ * if pool is empty or `size` is greater than block size, block is allocated by my_alloc()
+ * @param p    - pool
+ * @param size - size of block needed
+ * @return pointer to block
+ */
+void *pool_get(mempool *p, size_t size){
+    if(size > p->blksz || !p->freelist){
+        ++mem_pool_fallbacks_cnt;
+        return my_alloc(1, size);
+    }
+    void **b = p->freelist;
+    p->freelist = *b;
+    --p->nfree;
+    return b;
+}
+
+/**
+ * Return block into pool (or free it if it was allocated outside)
+ */
+void pool_put(mempool *p, void *blk){
+    if(!blk) return;
+    char *c = blk;
+    if(c < p->area || c >= p->area + p->blksz * p->nblocks){
+        free(blk);
+        return;
+    }
+    *(void**)blk = p->freelist;
+    p->freelist = blk;
+    ++p->nfree;
+}
+
+void pool_destroy(mempool **p){
+    if(!p || !*p) return;
+    FREE((*p)->area);
+    FREE(*p);
+}
+
 /**
  * Mmap file to a memory area
  *
@@ -100,6 +100,8 @@ extern void signals(int sig);
  */
 #define ALLOC(type, var, size)  type * var = ((type *)my_alloc(size, sizeof(type)))
 #define MALLOC(type, size) ((type *)my_alloc(size, sizeof(type)))
+#define REALLOC(ptr, type, size) ((type *)my_realloc(ptr, (size) * sizeof(type)))
+#define STRDUP(s)  my_strdup(s)
 #define FREE(ptr)  do{if(ptr){free(ptr); ptr = NULL;}}while(0)
 
 #ifndef DBL_EPSILON
@@ -113,6 +115,24 @@ extern int (*red)(const char *fmt, ...);
 extern int (*_WARN)(const char *fmt, ...);
 extern int (*green)(const char *fmt, ...);
 void * my_alloc(size_t N, size_t S);
+void *my_realloc(void *ptr, size_t size);
+char *my_strdup(const char *s);
+void mem_steady(int on);
+size_t mem_steady_allocs();
+size_t mem_pool_fallbacks();
+
+// pool of fixed-size blocks: all memory is allocated at once, blocks are recycled by free list
+typedef struct{
+    size_t blksz;       // size of block
+    size_t nblocks;     // amount of blocks
+    size_t nfree;       // amount of free blocks
+    void *freelist;     // first free block (free block contains pointer to next)
+    char *area;         // memory of all blocks
+} mempool;
+mempool *pool_create(size_t blksz, size_t nblocks);
+void *pool_get(mempool *p, size_t size);
+void pool_put(mempool *p, void *blk);
+void pool_destroy(mempool **p);
 void initial_setup();
 
 // mmap file